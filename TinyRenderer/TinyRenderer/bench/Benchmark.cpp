@@ -0,0 +1,288 @@
+/* fixed workloads for the rasterizer, the clipper, interpolation and present, one JSON object per line on stdout:
+   tinyrenderer_bench [--threads N] [--min-time seconds] [--filter text] */
+
+/* the counters give the triangle and pixel counts behind the throughput figures, the same few adds per quad in every run */
+#define RENDER_STATS 1
+
+#include "Utils.h"
+#include "Device.h"
+#include "Texture.h"
+#include "RenderStages.h"
+#include "Shaders/BasicShader.h"
+#include "Shaders/PhongShader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+using BasicPipeline = RenderPipeline<VertexShader, FragmentShader, Uniform, VSIn, VSOut, FSIn, FSOut>;
+using PhongPipeline = RenderPipeline<PhongVertexShader, PhongFragmentShader, PhongUniform,
+	PhongVSIn, PhongVSOut, PhongFSIn, PhongFSOut>;
+
+struct BenchOptions
+{
+	int threads = 1;
+	double min_time = 0.5;
+	std::string filter;
+};
+
+/* triangles and pixels handled by one iteration */
+struct BenchWork
+{
+	uint64_t triangles;
+	uint64_t pixels;
+};
+
+/* the median over repeats of fn until min_time has passed, after one warm up call; fn returns its work */
+void run_bench(BenchOptions const & options, std::string const & name, std::function<BenchWork()> const & fn)
+{
+	if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+
+	BenchWork const work = fn();
+	std::vector<double> times;
+	double total = 0.0;
+	while (times.size() < 3 || total < options.min_time)
+	{
+		auto const start = std::chrono::steady_clock::now();
+		fn();
+		double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		times.push_back(seconds);
+		total += seconds;
+	}
+	std::sort(times.begin(), times.end());
+	double const median = times[times.size() / 2];
+
+	std::printf("{ \"benchmark\": \"%s\", \"threads\": %d, \"iterations\": %d, \"ms\": %.4f, "
+		"\"triangles\": %llu, \"pixels\": %llu, \"mtri_per_s\": %.3f, \"mpix_per_s\": %.3f }\n",
+		name.c_str(), options.threads, int(times.size()), median * 1e3,
+		(unsigned long long)work.triangles, (unsigned long long)work.pixels,
+		work.triangles / median * 1e-6, work.pixels / median * 1e-6);
+	std::fflush(stdout);
+}
+
+/////////////////////////////////
+// geometry
+/////////////////////////////////
+
+int const width = 1280, height = 720;
+float const near_plane = 1.0f, far_plane = 100.0f;
+
+/* 90 degrees both ways, so a point at view depth d lands on screen from its x / d and y / d */
+Mat4f bench_projection()
+{
+	Mat4f mat = Mat4f::Zero();
+	mat.coeffRef(0, 0) = 1.0f;
+	mat.coeffRef(1, 1) = 1.0f;
+	mat.coeffRef(2, 2) = -(far_plane + near_plane) / (far_plane - near_plane);
+	mat.coeffRef(2, 3) = -2.0f * far_plane * near_plane / (far_plane - near_plane);
+	mat.coeffRef(3, 2) = -1.0f;
+	return mat;
+}
+
+/* the view space point at distance depth in front of the eye that projects to pixel (x, y) */
+Vec3f at_pixel(float x, float y, float depth)
+{
+	return Vec3f{ (2.0f * x / width - 1.0f) * depth, (2.0f * y / height - 1.0f) * depth, -depth };
+}
+
+/* positions of a triangle list, every 3 consecutive ones form a triangle */
+using TriangleList = std::vector<Vec3f>;
+
+/* right triangles with legs of size pixels on a grid of pitch pixels, layers of them from far to near */
+TriangleList triangle_grid(float size, float pitch, int layers)
+{
+	TriangleList tris;
+	for (int layer = 0; layer < layers; ++layer)
+	{
+		float const depth = 10.0f - layer;
+		for (float y = 0.0f; y + size <= height; y += pitch)
+			for (float x = 0.0f; x + size <= width; x += pitch)
+			{
+				tris.push_back(at_pixel(x, y, depth));
+				tris.push_back(at_pixel(x + size, y, depth));
+				tris.push_back(at_pixel(x, y + size, depth));
+			}
+	}
+	return tris;
+}
+
+/* triangles covering the whole screen, far to near so that each one passes the depth test */
+TriangleList fullscreen_triangles(int cnt)
+{
+	TriangleList tris;
+	for (int i = 0; i < cnt; ++i)
+	{
+		float const depth = 50.0f - i;
+		tris.push_back(at_pixel(0.0f, 0.0f, depth));
+		tris.push_back(at_pixel(2.0f * width, 0.0f, depth));
+		tris.push_back(at_pixel(0.0f, 2.0f * height, depth));
+	}
+	return tris;
+}
+
+/* 48 pixel triangles at random places, a share of clipped_percent of them reaching behind the near plane with one vertex */
+TriangleList near_clip_triangles(int cnt, int clipped_percent)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> px(0.0f, width - 48.0f), py(0.0f, height - 48.0f);
+	TriangleList tris;
+	for (int i = 0; i < cnt; ++i)
+	{
+		float const x = px(rng), y = py(rng);
+		float const depth = 2.0f + 0.001f * i;
+		bool const clipped = i * 100 < clipped_percent * cnt;
+		tris.push_back(at_pixel(x, y, depth));
+		tris.push_back(at_pixel(x + 48.0f, y, depth));
+		tris.push_back(clipped ? at_pixel(x, y + 48.0f, 0.5f * near_plane) : at_pixel(x, y + 48.0f, depth));
+	}
+	return tris;
+}
+
+void make_inputs(TriangleList const & tris, std::vector<VSIn> & inputs)
+{
+	inputs.resize(tris.size());
+	for (size_t i = 0; i < tris.size(); ++i)
+	{
+		inputs[i].position = tris[i];
+		inputs[i].tex_coord = Vec2f{ float(i % 3 == 1), float(i % 3 == 2) };
+	}
+}
+
+void make_inputs(TriangleList const & tris, std::vector<PhongVSIn> & inputs)
+{
+	inputs.resize(tris.size());
+	for (size_t i = 0; i < tris.size(); ++i)
+	{
+		inputs[i].position = tris[i];
+		inputs[i].normal = Vec3f{ 0.3f * float(i % 3 == 1), 0.3f * float(i % 3 == 2), 1.0f }.normalized();
+	}
+}
+
+Uniform basic_uniform()
+{
+	return Uniform{ Sample2D<FilterBilinear, Texture1, float>{ Texture1{} }, bench_projection() };
+}
+
+PhongUniform phong_uniform()
+{
+	PhongUniform uni;
+	uni.wvp = bench_projection();
+	uni.light_pos = Vec3f{ -5.0f, 5.0f, 2.0f };
+	uni.view_pos = Vec3f{ 0.0f, 0.0f, 0.0f };
+	uni.light_color = Vec3f{ 1.0f, 0.95f, 0.9f };
+	uni.albedo = Vec3f{ 0.6f, 0.2f, 0.2f };
+	uni.shininess = 32.0f;
+	return uni;
+}
+
+/////////////////////////////////
+// workloads
+/////////////////////////////////
+
+/* clear and render the whole list once per iteration, pixels are the shaded fragments */
+template <typename Pipeline, typename Input, typename Uni>
+void bench_render(BenchOptions const & options, std::string const & name, TriangleList const & tris,
+	Uni const & uni, MSAA msaa)
+{
+	Pipeline renderer(width, height);
+	renderer.set_thread_count(options.threads);
+	renderer.set_cull_mode(CullMode::None, FrontFace::CW);
+	renderer.set_lazy_clear(true);
+
+	std::vector<Input> inputs;
+	make_inputs(tris, inputs);
+	std::vector<int> elements(inputs.size());
+	for (size_t i = 0; i < elements.size(); ++i)
+		elements[i] = int(i);
+
+	run_bench(options, name, [&]()
+	{
+		renderer.clear_pipeline({ 0.0f, 0.0f, 0.0f, 1.0f });
+		renderer.render(inputs, elements, uni, msaa);
+		RenderStats const & stats = renderer.stats();
+		return BenchWork{ stats.triangles_in, stats.fragments_shaded };
+	});
+}
+
+void bench_raster(BenchOptions const & options)
+{
+	struct Shape
+	{
+		char const * name;
+		TriangleList tris;
+	};
+	Shape const shapes[] = {
+		{ "tiny", triangle_grid(2.0f, 4.0f, 1) },
+		{ "medium", triangle_grid(32.0f, 32.0f, 4) },
+		{ "fullscreen", fullscreen_triangles(16) } };
+
+	for (auto const & shape : shapes)
+		for (MSAA msaa : { MSAA::Standard, MSAA::MSAAx4 })
+		{
+			std::string const suffix = std::string("/") + shape.name + (msaa == MSAA::Standard ? "/standard" : "/msaa4x");
+			bench_render<BasicPipeline, VSIn>(options, "raster/basic" + suffix, shape.tris, basic_uniform(), msaa);
+			bench_render<PhongPipeline, PhongVSIn>(options, "raster/phong" + suffix, shape.tris, phong_uniform(), msaa);
+		}
+}
+
+void bench_clip(BenchOptions const & options)
+{
+	for (int percent : { 0, 50, 100 })
+		bench_render<BasicPipeline, VSIn>(options, "clip/near_" + std::to_string(percent),
+			near_clip_triangles(4000, percent), basic_uniform(), MSAA::Standard);
+}
+
+/* flush_buffer of a RGBA32F target into the device frame, pixels are the frame size */
+void bench_flush(BenchOptions const & options)
+{
+	int const sizes[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	for (auto const & size : sizes)
+	{
+		int const w = size[0], h = size[1];
+		Buffer2D<Vec4f> buffer(w, h);
+		for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x)
+			buffer.coeff(x, y) = Vec4f{ float(x) / w, float(y) / h, 0.5f, 1.0f };
+		device_t device;
+		device_init(&device, w, h, NULL);
+
+		run_bench(options, "flush/" + std::to_string(w) + "x" + std::to_string(h), [&]()
+		{
+			flush_buffer(device, buffer, w, h);
+			return BenchWork{ 0, uint64_t(w) * h };
+		});
+		device_destroy(&device);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (i + 1 == argc)
+			argc = -1;
+		else if (std::strcmp(argv[i], "--threads") == 0)
+			options.threads = (std::max)(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "--min-time") == 0)
+			options.min_time = std::atof(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--filter") == 0)
+			options.filter = argv[i + 1];
+		else
+			argc = -1;
+	}
+	if (argc < 0)
+	{
+		std::fprintf(stderr, "usage: %s [--threads N] [--min-time seconds] [--filter text]\n", argv[0]);
+		return -1;
+	}
+
+	bench_raster(options);
+	bench_clip(options);
+	bench_flush(options);
+	return 0;
+}
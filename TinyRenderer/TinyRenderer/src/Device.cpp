@@ -2,6 +2,9 @@
 #ifdef USE_MY_MINI3D
 
 #include "Device.h"
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
 
 ////////////////////////////////////
 //// Ⱦ豸
@@ -93,6 +96,7 @@ void device_pixel(device_t *device, int x, int y, UINT32 color) {
 	}
 }
 
+#ifdef _WIN32
 //////////////////////////////////
 // Win32 ڼͼλƣΪ device ṩһ DibSection  FB
 //////////////////////////////////
@@ -220,30 +224,12 @@ void screen_update(void) {
 	ReleaseDC(screen_handle, hDC);
 	screen_dispatch();
 }
+#endif
 
 
-template<class T>
-constexpr const T& clamp(const T& v, const T& lo, const T& hi)
-{
-	return (lo >= v ? lo : (v < hi ? v : hi));
-}
-
 void flush_buffer(device_t & device, Buffer2D<Vec4f> const & buffer, size_t width, size_t height)
 {
-	long size = 0;
-	//BYTE * bmp_buffer = ConvertRGBToBMPBuffer(buffer.get_raw_buffer(), buffer.m_width, buffer.m_height, size);
-	//SaveBMP(bmp_buffer, buffer.m_width, buffer.m_height, size, _T("..//01.bmp"));
-
-	for (int x = 0; x < width; x++) for (int y = 0; y < height; y++)
-	{
-		auto const & val = buffer.coeff(x, y);
-		//auto val = Vec4f{ 0.5f, 0.5f, 0.5f, 1.0f };
-		unsigned int r = clamp<unsigned int>(val.x() * 255.f, 0, 255) & 0xff;
-		unsigned int g = clamp<unsigned int>(val.y() * 255.f, 0, 255) & 0xff;
-		unsigned int b = clamp<unsigned int>(val.z() * 255.f, 0, 255) & 0xff;
-		unsigned int a = clamp<unsigned int>(val.w() * 255.f, 0, 255) & 0xff;
-		device.framebuffer[height - y - 1][x] = UINT32((r << 16) | (g << 8) | b);
-	}
+	flush_buffer<RGBA32F, RowMajor>(device, buffer, width, height);
 }
 
 
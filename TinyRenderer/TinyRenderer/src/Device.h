@@ -1,11 +1,15 @@
-#ifndef Device
-#define Device
+#ifndef DEVICE_H
+#define DEVICE_H
 
 #include "Utils.h"
+#include "PostProcess.h"
 
+#include <chrono>
+
+#ifdef _WIN32
 #include <windows.h>
 #include <tchar.h>
-#include <chrono>
+#endif
 
 //////////////////////////////////
 // Ⱦ豸
@@ -45,6 +49,7 @@ void device_destroy(device_t *device);
 // 
 void device_pixel(device_t *device, int x, int y, UINT32 color);
 
+#ifdef _WIN32
 //////////////////////////////////
 // Win32 ڼͼλƣΪ device ṩһ DibSection  FB
 //////////////////////////////////
@@ -67,13 +72,22 @@ static LRESULT screen_events(HWND, UINT, WPARAM, LPARAM);
 #pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "user32.lib")
 #endif
+#endif
 
 void flush_buffer(device_t & device, Buffer2D<Vec4f> const & buffer, size_t width, size_t height);
 
+/* render targets in a compact format or layout, ColorFormat from PixelFormat.h */
+template <typename ColorFormat, typename Layout>
+void flush_buffer(device_t & device, Buffer2D<typename ColorFormat::storage_type, Layout> const & buffer, size_t width, size_t height)
+{
+	TRACE_SCOPE("flush_buffer");
+	present<ColorFormat, Layout>(buffer, device.framebuffer, int(width), int(height));
+}
+
 inline long long current_million_seconds()
 {
 	return std::chrono::duration_cast<std::chrono::milliseconds>(
-		std::chrono::system_clock::now().time_since_epoch()).count();
+		std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+#ifndef EDGE_FUNCTION_H
+#define EDGE_FUNCTION_H
+
+#include "Utils.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EDGE_FUNCTION_SSE2
+#include <emmintrin.h>
+#endif
+
+/////////////////////////////////
+// edge function coverage
+/////////////////////////////////
+
+inline float edge_equation(Vec2f const & p, Vec2f const & v1, Vec2f const & v2)
+{
+	return (p.y() - v2.y()) * (v1.x() - v2.x()) - (p.x() - v2.x()) * (v1.y() - v2.y());
+}
+
+inline bool top_left(Vec2f const & v1, Vec2f const & v2)
+{
+	return (v1.x() <= v2.x()) && (v1.y() <= v2.y());
+}
+
+/* per triangle constants for testing the three edge equations on several pixels at once */
+struct EdgeSetup
+{
+	/* edge value of each lane relative to the first pixel, quad lane is i * 2 + j for pixel (x + i, y + j) */
+	float quad_offset[3][4];
+	/* edge value change per pixel step in x and in y */
+	float step_x[3], step_y[3];
+	int top_left_mask;
+	float eps;
+
+	/* edge k runs between the two vertices other than vertex k */
+	EdgeSetup(Vec2f const & v0, Vec2f const & v1, Vec2f const & v2, float eps) :
+		top_left_mask(0), eps(eps)
+	{
+		Vec2f const * const v[3] = { &v0, &v1, &v2 };
+		for (int k = 0; k < 3; ++k)
+		{
+			Vec2f const & from = *v[(k + 1) % 3], & to = *v[(k + 2) % 3];
+			step_x[k] = to.y() - from.y();
+			step_y[k] = from.x() - to.x();
+			for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+				quad_offset[k][i * 2 + j] = i * step_x[k] + j * step_y[k];
+			if (top_left(from, to)) top_left_mask |= 1 << k;
+		}
+	}
+};
+
+/* lane edge values without the coverage test, for blocks known to be fully covered */
+inline void quad_edges(EdgeSetup const & setup, float const (&edge)[3], float(&edge_out)[3][4])
+{
+	for (int k = 0; k < 3; ++k) for (int l = 0; l < 4; ++l)
+		edge_out[k][l] = edge[k] + setup.quad_offset[k][l];
+}
+
+inline bool edge_inside(float e, bool is_top_left, float eps)
+{
+	return e > eps || (std::abs(e) < eps && is_top_left);
+}
+
+/* lane bit set when the pixel is covered under the top-left fill rule, lane edge values go to edge_out */
+inline int quad_coverage_scalar(EdgeSetup const & setup, float const (&edge)[3], float(&edge_out)[3][4])
+{
+	int mask = 0xf;
+	for (int k = 0; k < 3; ++k)
+	{
+		bool const is_top_left = (setup.top_left_mask >> k) & 1;
+		for (int l = 0; l < 4; ++l)
+		{
+			edge_out[k][l] = edge[k] + setup.quad_offset[k][l];
+			if (!edge_inside(edge_out[k][l], is_top_left, setup.eps))
+				mask &= ~(1 << l);
+		}
+	}
+	return mask;
+}
+
+#ifdef EDGE_FUNCTION_SSE2
+
+inline __m128 edge_inside_sse(__m128 e, int is_top_left, __m128 eps)
+{
+	__m128 const abs_e = _mm_andnot_ps(_mm_set1_ps(-0.0f), e);
+	__m128 const on_edge = _mm_and_ps(_mm_cmplt_ps(abs_e, eps), _mm_castsi128_ps(_mm_set1_epi32(-is_top_left)));
+	return _mm_or_ps(_mm_cmpgt_ps(e, eps), on_edge);
+}
+
+inline int quad_coverage_sse(EdgeSetup const & setup, float const (&edge)[3], float(&edge_out)[3][4])
+{
+	__m128 const eps = _mm_set1_ps(setup.eps);
+	__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (int k = 0; k < 3; ++k)
+	{
+		__m128 const e = _mm_add_ps(_mm_set1_ps(edge[k]), _mm_loadu_ps(setup.quad_offset[k]));
+		_mm_storeu_ps(edge_out[k], e);
+		inside = _mm_and_ps(inside, edge_inside_sse(e, (setup.top_left_mask >> k) & 1, eps));
+	}
+	return _mm_movemask_ps(inside);
+}
+
+#endif
+
+/* SSE2 wherever the compiler targets it, which x86-64 always does; 32 bit x86 without it and other targets stay scalar */
+inline int quad_coverage(EdgeSetup const & setup, float const (&edge)[3], float(&edge_out)[3][4])
+{
+#ifdef EDGE_FUNCTION_SSE2
+	return quad_coverage_sse(setup, edge, edge_out);
+#else
+	return quad_coverage_scalar(setup, edge, edge_out);
+#endif
+}
+
+#endif
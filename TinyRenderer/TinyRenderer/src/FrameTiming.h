@@ -0,0 +1,220 @@
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "winmm.lib")
+#endif
+#endif
+
+/////////////////////////////////
+// frame timing
+/////////////////////////////////
+
+inline uint64_t steady_nano_seconds()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/* log-linear buckets as in HdrHistogram: exact below 2^sub_bits ns, then 2^sub_bits buckets per power of two,
+   so a percentile is off by less than 1 / 2^sub_bits of its value; values from 2^max_bits ns on share the last bucket */
+class LatencyHistogram
+{
+public:
+	static int const sub_bits = 5;
+	static int const max_bits = 44;
+
+	LatencyHistogram()
+	{
+		reset();
+	}
+
+	void record(uint64_t ns)
+	{
+		m_counts[bucket(ns)] += 1;
+		m_count += 1;
+		if (ns > m_max) m_max = ns;
+	}
+
+	void reset()
+	{
+		m_counts.fill(0);
+		m_count = 0;
+		m_max = 0;
+	}
+
+	uint64_t count() const { return m_count; }
+	uint64_t max_value() const { return m_max; }
+
+	/* the upper end of the bucket holding the value below which a fraction p of the samples lie, at most max_value() */
+	uint64_t percentile(double p) const
+	{
+		if (m_count == 0) return 0;
+		uint64_t rank = uint64_t(p * double(m_count) + 0.5);
+		if (rank < 1) rank = 1;
+		if (rank > m_count) rank = m_count;
+
+		uint64_t seen = 0;
+		for (int i = 0; i < bucket_cnt; ++i)
+		{
+			seen += m_counts[i];
+			if (seen >= rank && i < bucket_cnt - 1)
+				return upper_bound(i) < m_max ? upper_bound(i) : m_max;
+		}
+		return m_max;
+	}
+
+private:
+	static int const sub_cnt = 1 << sub_bits;
+	static int const bucket_cnt = (max_bits - sub_bits + 1) * sub_cnt;
+
+	static int bucket(uint64_t ns)
+	{
+		if (ns < uint64_t(sub_cnt)) return int(ns);
+		int msb = sub_bits;
+		while (msb + 1 < max_bits && (ns >> (msb + 1)) != 0) ++msb;
+		if ((ns >> max_bits) != 0) return bucket_cnt - 1;
+		int const sub = int(ns >> (msb - sub_bits)) & (sub_cnt - 1);
+		return (msb - sub_bits + 1) * sub_cnt + sub;
+	}
+
+	static uint64_t upper_bound(int index)
+	{
+		if (index < sub_cnt) return uint64_t(index);
+		int const shift = index / sub_cnt - 1;
+		uint64_t const lower = uint64_t(sub_cnt + index % sub_cnt) << shift;
+		return lower + (uint64_t(1) << shift) - 1;
+	}
+
+	std::array<uint64_t, bucket_cnt> m_counts;
+	uint64_t m_count;
+	uint64_t m_max;
+};
+
+/* Convert is present_stage() into the 0x00RRGGBB frame, Present hands that frame on, to the window or to a file;
+   Frame is the whole iteration of the loop, from one begin_frame() to the next */
+enum class FramePhase
+{
+	Render, Convert, Present, Frame, Count
+};
+
+/* per phase histograms of a frame loop: each end_phase() records the time since the previous mark,
+   end_frame() is true once every report_interval frames, when report() is due */
+class FrameTimings
+{
+public:
+	explicit FrameTimings(int report_interval = 60) :
+		m_report_interval(report_interval > 0 ? report_interval : 1)
+	{}
+
+	void begin_frame()
+	{
+		uint64_t const now = steady_nano_seconds();
+		if (m_frame_start != 0)
+			m_histograms[int(FramePhase::Frame)].record(now - m_frame_start);
+		m_frame_start = m_mark = now;
+	}
+
+	void end_phase(FramePhase phase)
+	{
+		uint64_t const now = steady_nano_seconds();
+		m_histograms[int(phase)].record(now - m_mark);
+		m_mark = now;
+	}
+
+	/* time spent outside the measured phases goes to no phase */
+	void skip_phase()
+	{
+		m_mark = steady_nano_seconds();
+	}
+
+	bool end_frame()
+	{
+		return ++m_frame_cnt % m_report_interval == 0;
+	}
+
+	LatencyHistogram const & histogram(FramePhase phase) const
+	{
+		return m_histograms[int(phase)];
+	}
+
+	/* one line per recorded phase in milliseconds, the histograms start over afterwards */
+	std::string report()
+	{
+		static char const * const names[] = { "render", "convert", "present", "frame" };
+		std::string text;
+		for (int i = 0; i < int(FramePhase::Count); ++i)
+		{
+			LatencyHistogram & histogram = m_histograms[i];
+			if (histogram.count() == 0) continue;
+			char line[160];
+			std::snprintf(line, sizeof(line), "%-8s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms  (%llu frames)\n",
+				names[i], histogram.percentile(0.5) * 1e-6, histogram.percentile(0.9) * 1e-6,
+				histogram.percentile(0.99) * 1e-6, histogram.max_value() * 1e-6, (unsigned long long)histogram.count());
+			text += line;
+			histogram.reset();
+		}
+		return text;
+	}
+
+private:
+	int const m_report_interval;
+	std::array<LatencyHistogram, int(FramePhase::Count)> m_histograms;
+	uint64_t m_frame_start = 0;
+	uint64_t m_mark = 0;
+	uint64_t m_frame_cnt = 0;
+};
+
+/* holds a loop to a fixed rate by sleeping until the deadline of the next frame;
+   a frame finishing past its deadline restarts the schedule from now rather than rushing the following frames */
+class FramePacer
+{
+public:
+	explicit FramePacer(double frames_per_second) :
+		m_period(std::chrono::nanoseconds(int64_t(1e9 / frames_per_second))),
+		m_next(std::chrono::steady_clock::now() + m_period)
+	{
+#ifdef _WIN32
+		/* the default 15.6 ms timer tick would round every sleep up */
+		timeBeginPeriod(1);
+#endif
+	}
+
+	~FramePacer()
+	{
+#ifdef _WIN32
+		timeEndPeriod(1);
+#endif
+	}
+
+	FramePacer(FramePacer const &) = delete;
+	FramePacer & operator=(FramePacer const &) = delete;
+
+	void wait()
+	{
+		auto const now = std::chrono::steady_clock::now();
+		if (now >= m_next)
+		{
+			m_next = now + m_period;
+			return;
+		}
+		std::this_thread::sleep_until(m_next);
+		m_next += m_period;
+	}
+
+private:
+	std::chrono::steady_clock::duration const m_period;
+	std::chrono::steady_clock::time_point m_next;
+};
+
+#endif
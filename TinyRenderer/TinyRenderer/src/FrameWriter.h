@@ -0,0 +1,180 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include "Utils.h"
+#include "Trace.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+/////////////////////////////////
+// frame output
+/////////////////////////////////
+
+/* Ppm is binary rgb, Raw the 0x00RRGGBB words as they are in memory; both top row first */
+enum class FrameFileFormat
+{
+	Ppm, Raw
+};
+
+/* writes frames to disk on its own thread so that file output overlaps rendering the next frame;
+   at most max_pending frames wait, write() blocks beyond that, frame memory is recycled */
+class FrameWriter
+{
+public:
+	explicit FrameWriter(int max_pending = 3) :
+		m_max_pending((std::max)(1, max_pending))
+	{
+		m_thread = std::thread(&FrameWriter::writer_loop, this);
+	}
+
+	/* the queued frames are still written */
+	~FrameWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+	}
+
+	FrameWriter(FrameWriter const &) = delete;
+	FrameWriter & operator=(FrameWriter const &) = delete;
+
+	/* copies the top-down rows of a width by height frame, e.g. device_t::framebuffer, the caller may reuse them at once */
+	void write(RGBA32 const * const * rows, int width, int height, std::string const & path,
+		FrameFileFormat format = FrameFileFormat::Ppm)
+	{
+		Frame frame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_space.wait(lock, [this]() { return int(m_queue.size()) < m_max_pending; });
+			if (!m_free.empty())
+			{
+				frame.pixels.swap(m_free.back());
+				m_free.pop_back();
+			}
+		}
+
+		frame.pixels.resize(size_t(width) * height);
+		for (int y = 0; y < height; ++y)
+			std::memcpy(&frame.pixels[size_t(y) * width], rows[y], sizeof(RGBA32) * width);
+		frame.width = width;
+		frame.height = height;
+		frame.path = path;
+		frame.format = format;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(std::move(frame));
+		}
+		m_wake.notify_one();
+	}
+
+	/* return when every frame given so far is on disk */
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this]() { return m_queue.empty() && !m_writing; });
+	}
+
+	/* frames whose file could not be opened or written */
+	int failed_count()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_failed;
+	}
+
+private:
+	struct Frame
+	{
+		std::vector<RGBA32> pixels;
+		int width = 0;
+		int height = 0;
+		std::string path;
+		FrameFileFormat format = FrameFileFormat::Ppm;
+	};
+
+	void writer_loop()
+	{
+		Tracer::instance().set_thread_name("frame writer");
+		std::vector<unsigned char> row;
+		while (true)
+		{
+			Frame frame;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this]() { return m_exit || !m_queue.empty(); });
+				if (m_queue.empty()) return;
+				frame = std::move(m_queue.front());
+				m_queue.pop_front();
+				m_writing = true;
+			}
+			m_space.notify_one();
+
+			bool ok;
+			{
+				TRACE_SCOPE("write_frame");
+				ok = write_file(frame, row);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!ok) ++m_failed;
+				m_free.push_back(std::move(frame.pixels));
+				m_writing = false;
+			}
+			m_idle.notify_all();
+		}
+	}
+
+	static bool write_file(Frame const & frame, std::vector<unsigned char> & row)
+	{
+		FILE * file = std::fopen(frame.path.c_str(), "wb");
+		if (!file) return false;
+
+		bool ok = true;
+		if (frame.format == FrameFileFormat::Raw)
+		{
+			ok = std::fwrite(frame.pixels.data(), sizeof(RGBA32), frame.pixels.size(), file) == frame.pixels.size();
+		}
+		else
+		{
+			ok = std::fprintf(file, "P6\n%d %d\n255\n", frame.width, frame.height) > 0;
+			row.resize(size_t(frame.width) * 3);
+			for (int y = 0; ok && y < frame.height; ++y)
+			{
+				RGBA32 const * src = &frame.pixels[size_t(y) * frame.width];
+				for (int x = 0; x < frame.width; ++x)
+				{
+					row[x * 3] = (unsigned char)(src[x] >> 16);
+					row[x * 3 + 1] = (unsigned char)(src[x] >> 8);
+					row[x * 3 + 2] = (unsigned char)src[x];
+				}
+				ok = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+			}
+		}
+		return std::fclose(file) == 0 && ok;
+	}
+
+	int const m_max_pending;
+	std::deque<Frame> m_queue;
+	std::vector<std::vector<RGBA32>> m_free;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_space;
+	std::condition_variable m_idle;
+	int m_failed = 0;
+	bool m_writing = false;
+	bool m_exit = false;
+	std::thread m_thread;
+};
+
+#endif
@@ -2,26 +2,167 @@
 #include "Device.h"
 #include "Texture.h"
 #include "RenderStages.h"
-#include "Shaders\BasicShader.h"
+#include "FrameWriter.h"
+#include "SharedFrame.h"
+#include "Trace.h"
+#include "FrameTiming.h"
+#include "Shaders/BasicShader.h"
 #include <iostream>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-int main()
+using Renderer = RenderPipeline<VertexShader, FragmentShader, Uniform, VSIn, VSOut, FSIn, FSOut>;
+
+/* frames between two frame time reports */
+int const report_interval = 60;
+
+/* the rotating quad of frame cnt */
+Uniform frame_uniform(int cnt)
+{
+	auto const p = proj_mat(90, 4/3, 1, 100);
+	float scale = 0.02f;
+	Mat4f w1;
+	w1 << 1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, std::cos(cnt * scale), -std::sin(cnt * scale), 0.0f,
+		0.0f, std::sin(cnt * scale), std::cos(cnt * scale), 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f;
+	Mat4f w2;
+	w2 << 1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, -20.0f,
+		0.0f, 0.0f, 0.0f, 1.0f;
+
+	Mat4f wvp = p * w2 * w1;
+
+	return Uniform{ Sample2D<FilterBilinear, Texture1, float>{ Texture1{} }, wvp };
+}
+
+/* render frame_cnt frames without a window into a device owning its frame memory,
+   frame i is written to <prefix><i>.ppm on a background thread while the next one renders */
+int render_offscreen(Renderer & renderer, std::vector<VSIn> const & inputs, std::vector<int> const & elements,
+	int width, int height, int frame_cnt, std::string const & prefix)
 {
 	device_t device;
+	device_init(&device, width, height, NULL);
+	FrameWriter writer;
+	FrameTimings timings(report_interval);
 
-	std::size_t const width = 800, const height = 600;
-	RenderPipeline<VertexShader, FragmentShader, Uniform, VSIn, VSOut, FSIn, FSOut> renderer(width, height);
+	long long const start = current_million_seconds();
+	for (int i = 0; i < frame_cnt; ++i)
+	{
+		timings.begin_frame();
+		renderer.clear_pipeline({ 0.1f, 0.1f, 0.1f, 1.0f });
+		auto const & framebuffer = renderer.render(inputs, elements, frame_uniform(10 + i), MSAA::Standard);
+		timings.end_phase(FramePhase::Render);
+		renderer.present_stage(framebuffer, device.framebuffer, width, height);
+		timings.end_phase(FramePhase::Convert);
+
+		char index[16];
+		std::snprintf(index, sizeof(index), "%04d", i);
+		writer.write(device.framebuffer, width, height, prefix + index + ".ppm");
+		timings.end_phase(FramePhase::Present);
+		if (timings.end_frame())
+			std::cout << timings.report();
+	}
+	writer.flush();
+	long long const elapsed = current_million_seconds() - start;
+
+	std::cout << timings.report();
+	std::cout << frame_cnt << " frames in " << elapsed << " ms" << std::endl;
+#if RENDER_STATS
+	std::cout << renderer.stats().to_json() << std::endl;
+#endif
+	device_destroy(&device);
+	if (writer.failed_count() > 0)
+	{
+		std::cerr << writer.failed_count() << " frames could not be written" << std::endl;
+		return -1;
+	}
+	return 0;
+}
 
-	if (screen_init(width, height, _T("TinyRenderer")))
+#ifndef _WIN32
+/* render frame_cnt frames straight into the slots of a shared memory ring for a viewer process to read */
+int render_shared(Renderer & renderer, std::vector<VSIn> const & inputs, std::vector<int> const & elements,
+	int width, int height, int frame_cnt, std::string const & name)
+{
+	SharedFrameExport frames;
+	if (!frames.create(name, width, height, 3, renderer.tile_size()))
+	{
+		std::cerr << "cannot create shared memory " << name << std::endl;
 		return -1;
+	}
 
-	device_init(&device, width, height, screen_fb);
+	for (int i = 0; i < frame_cnt; ++i)
+	{
+		renderer.clear_pipeline({ 0.1f, 0.1f, 0.1f, 1.0f });
+		auto const & framebuffer = renderer.render(inputs, elements, frame_uniform(10 + i), MSAA::Standard);
+		renderer.present_stage(framebuffer, frames.begin_frame(), width, height);
+		frames.publish();
+	}
+	return 0;
+}
+#endif
 
-	/* construct input */
-	auto const p = proj_mat(90, 4/3, 1, 100);
-	int cnt = 10;
-	long long last_million_seconds = current_million_seconds();
+/* the timeline of the run into trace_path when one was asked for, result passes through */
+int write_trace(int result, std::string const & trace_path)
+{
+	if (!trace_path.empty() && !Tracer::instance().write_chrome_trace(trace_path))
+	{
+		std::cerr << "cannot write trace " << trace_path << std::endl;
+		return -1;
+	}
+	return result;
+}
 
+/* TinyRenderer [--headless frame_cnt [path_prefix]] [--shm frame_cnt name] [--trace trace.json],
+   always headless without Win32, --shm is not built on Win32; 60 frames, frame_ and /tinyrenderer when left out */
+int main(int argc, char ** argv)
+{
+	std::string trace_path;
+	if (argc > 2 && std::strcmp(argv[argc - 2], "--trace") == 0)
+	{
+		trace_path = argv[argc - 1];
+		argc -= 2;
+		Tracer::instance().set_thread_name("main");
+		Tracer::instance().set_enabled(true);
+	}
+
+	bool headless = true;
+	bool shm = false;
+	int frame_cnt = 60;
+	std::string prefix = "frame_";
+	if (argc > 1)
+	{
+		headless = std::strcmp(argv[1], "--headless") == 0;
+#ifndef _WIN32
+		shm = std::strcmp(argv[1], "--shm") == 0;
+		if (shm) prefix = "/tinyrenderer";
+#endif
+		char * end = nullptr;
+		if (argc > 2) frame_cnt = int(std::strtol(argv[2], &end, 10));
+		if (argc > 3) prefix = argv[3];
+		if (!(headless || shm) || argc > 4 || frame_cnt <= 0 || (end && (end == argv[2] || *end != '\0')))
+		{
+			std::fprintf(stderr, "usage: %s [--headless frame_cnt [path_prefix]] [--shm frame_cnt name] [--trace trace.json]\n", argv[0]);
+			return -1;
+		}
+	}
+#ifdef _WIN32
+	else
+		headless = false;
+#endif
+
+	int const width = 800, height = 600;
+	Renderer renderer(width, height);
+	renderer.set_thread_count(std::thread::hardware_concurrency());
+	renderer.set_cull_mode(CullMode::Back, FrontFace::CW);
+	renderer.set_lazy_clear(true);
+
+	/* construct input */
 	std::vector<Vec3f> pos = {
 		{ 4.0f, 4.0f, 0.0f },
 		{ 4.0f, -4.0f, 0.0f },
@@ -41,56 +182,65 @@ int main()
 		inputs.push_back(vsin);
 	}
 
-	std::vector<int> elements = { 
-		2, 1, 0, 
+	std::vector<int> elements = {
+		2, 1, 0,
 		3, 1, 2,
 		0, 1, 2,
 		2, 1, 3
 	};
 
 	/* end construct input */
-	
+
+	if (shm)
+		return write_trace(render_shared(renderer, inputs, elements, width, height, frame_cnt, prefix), trace_path);
+	if (headless)
+		return write_trace(render_offscreen(renderer, inputs, elements, width, height, frame_cnt, prefix), trace_path);
+
+#ifdef _WIN32
+	device_t device;
+
+	if (screen_init(width, height, _T("TinyRenderer")))
+		return -1;
+
+	device_init(&device, width, height, screen_fb);
+
+	int cnt = 10;
+	FrameTimings timings(report_interval);
+	FramePacer pacer(60.0);
+
 	device.render_state = RENDER_STATE_TEXTURE;
 
 	while (screen_exit == 0 && screen_keys[VK_ESCAPE] == 0) {
+		timings.begin_frame();
 		screen_dispatch();
 		device_clear(&device, 1);
 
-		/* construct input */
 		cnt += 1;
-		float scale = 0.02f;
-		Mat4f w1; 
-		w1 << 1.0f, 0.0f, 0.0f, 0.0f,  
-			0.0f, std::cos(cnt * scale), -std::sin(cnt * scale), 0.0f,
-			0.0f, std::sin(cnt * scale), std::cos(cnt * scale), 0.0f,
-			0.0f, 0.0f, 0.0f, 1.0f;
-		Mat4f w2;
-		w2 << 1.0f, 0.0f, 0.0f, 0.0f,
-			0.0f, 1.0f, 0.0f, 0.0f,
-			0.0f, 0.0f, 1.0f, -20.0f,
-			0.0f, 0.0f, 0.0f, 1.0f;
-
-		Mat4f wvp = p * w2 * w1;
-
-		Uniform uniform = { Sample2D<FilterBilinear, Texture1, float>{ Texture1{} }, wvp };
-		/* end construct input */
+		Uniform uniform = frame_uniform(cnt);
+		timings.skip_phase();
 
 		renderer.clear_pipeline({ 0.1f, 0.1f, 0.1f, 1.0f });
-		auto framebuffer = renderer.render(inputs, elements, uniform, MSAA::Standard);
+		auto const & framebuffer = renderer.render(inputs, elements, uniform, MSAA::Standard);
 		//std::cout << cnt << std::endl;
+		timings.end_phase(FramePhase::Render);
+
+		renderer.present_stage(framebuffer, device.framebuffer, width, height);
+		timings.end_phase(FramePhase::Convert);
 
-		flush_buffer(device, framebuffer, width, height);
+		screen_update();
+		timings.end_phase(FramePhase::Present);
 
-		if (cnt % 20 == 0)
+		if (timings.end_frame())
 		{
-			auto tmp = current_million_seconds();
-			std::cout << "fps " << int(20 * 1000 / float(tmp - last_million_seconds)) << std::endl;
-			last_million_seconds = tmp;
+			std::cout << timings.report();
+#if RENDER_STATS
+			std::cout << renderer.stats().to_json() << std::endl;
+#endif
 		}
 
-		screen_update();
-		Sleep(1);
+		pacer.wait();
 	}
-	return 0;
+#endif
+	return write_trace(0, trace_path);
 
 }
\ No newline at end of file
@@ -0,0 +1,345 @@
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include "Utils.h"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXEL_FORMAT_SSE2
+#include <emmintrin.h>
+#endif
+
+/////////////////////////////////
+// render target formats
+/////////////////////////////////
+
+/* a format maps the shader side value to storage_type and back, and specializes the operations on stored pixels */
+
+inline float saturate(float v)
+{
+	return v <= 0.0f ? 0.0f : (v >= 1.0f ? 1.0f : v);
+}
+
+inline uint32_t unorm8(float v)
+{
+	return uint32_t(saturate(v) * 255.0f + 0.5f);
+}
+
+inline uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	uint32_t const sign = (x >> 16) & 0x8000;
+	uint32_t const abs = x & 0x7fffffff;
+
+	/* overflow, inf and nan */
+	if (abs >= 0x47800000)
+		return uint16_t(sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00));
+
+	/* below the smallest normal half, a multiple of 2^-24 */
+	if (abs < 0x38800000)
+	{
+		float v;
+		std::memcpy(&v, &abs, sizeof(v));
+		return uint16_t(sign | uint32_t(std::lrint(v * 16777216.0f)));
+	}
+
+	/* rebias the exponent and round the mantissa to nearest even */
+	uint32_t const rounded = abs + 0xc8000fff + ((abs >> 13) & 1);
+	return uint16_t(sign | (rounded >> 13));
+}
+
+inline float half_to_float(uint16_t h)
+{
+	uint32_t const sign = uint32_t(h & 0x8000) << 16;
+	uint32_t const exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+	if (exponent == 0)
+	{
+		float const v = float(mantissa) * (1.0f / 16777216.0f);
+		return sign ? -v : v;
+	}
+
+	uint32_t const x = exponent == 0x1f ?
+		sign | 0x7f800000 | (mantissa << 13) :
+		sign | ((exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+/* blend by decoding, the result alpha is always 1 */
+template <typename Format>
+inline void blend_decoded(typename Format::storage_type & dst, Vec4f const & src)
+{
+	if (src.w() >= 1.0f)
+	{
+		dst = Format::encode(Vec4f{ src.x(), src.y(), src.z(), 1.0f });
+		return;
+	}
+	Vec4f color = lerp(Format::decode(dst), src, src.w());
+	color.w() = 1.0f;
+	dst = Format::encode(color);
+}
+
+/* average of count samples by decoding, Vec4f sums vectorize under Eigen */
+template <typename Format>
+inline typename Format::storage_type resolve_decoded(typename Format::storage_type const * samples, int count)
+{
+	Vec4f sum = Format::decode(samples[0]);
+	for (int s = 1; s < count; ++s)
+		sum += Format::decode(samples[s]);
+	return Format::encode(sum * (1.0f / count));
+}
+
+/* one pixel after another, for formats without a vectorized conversion */
+template <typename Format>
+inline void to_xrgb8_each(typename Format::storage_type const * src, RGBA32 * dst, int count)
+{
+	for (int i = 0; i < count; ++i)
+		dst[i] = Format::to_xrgb8(src[i]);
+}
+
+/* colour formats: encode, decode, blend the fragment colour over a stored pixel with its alpha,
+   resolve the samples of a pixel, convert a pixel or a run of count pixels to 0x00RRGGBB */
+
+/* 16 bytes per pixel */
+struct RGBA32F
+{
+	using storage_type = Vec4f;
+
+	static storage_type encode(Vec4f const & color) { return color; }
+	static Vec4f decode(storage_type const & v) { return v; }
+
+	static void blend(storage_type & dst, Vec4f const & src)
+	{
+		dst = lerp(dst, src, src.w());
+		dst.w() = 1.0f;
+	}
+
+	static storage_type resolve(storage_type const * samples, int count)
+	{
+		return resolve_decoded<RGBA32F>(samples, count);
+	}
+
+	/* truncating, as the device always did */
+	static RGBA32 to_xrgb8(storage_type const & v)
+	{
+		auto const channel = [](float c) { return c <= 0.0f ? 0u : (c >= 255.0f ? 255u : uint32_t(c)); };
+		return (channel(v.x() * 255.f) << 16) | (channel(v.y() * 255.f) << 8) | channel(v.z() * 255.f);
+	}
+
+	/* 4 pixels at a time, swizzled to b g r a before the clamp and truncation so they pack straight into 0x00RRGGBB */
+	static void to_xrgb8(storage_type const * src, RGBA32 * dst, int count)
+	{
+		int i = 0;
+#ifdef PIXEL_FORMAT_SSE2
+		__m128 const scale = _mm_set1_ps(255.0f), zero = _mm_setzero_ps();
+		__m128i const rgb_mask = _mm_set1_epi32(0x00ffffff);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i c[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128 v = _mm_loadu_ps(src[i + k].data());
+				v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2));
+				c[k] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(v, scale), zero), scale));
+			}
+			__m128i const packed = _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_and_si128(packed, rgb_mask));
+		}
+#endif
+		to_xrgb8_each<RGBA32F>(src + i, dst + i, count - i);
+	}
+};
+
+/* r in the lowest byte */
+struct RGBA8
+{
+	using storage_type = uint32_t;
+
+	static storage_type encode(Vec4f const & color)
+	{
+		return unorm8(color.x()) | (unorm8(color.y()) << 8) | (unorm8(color.z()) << 16) | (unorm8(color.w()) << 24);
+	}
+
+	static Vec4f decode(storage_type v)
+	{
+		return Vec4f{ float(v & 0xff), float((v >> 8) & 0xff), float((v >> 16) & 0xff), float(v >> 24) } * (1.0f / 255.0f);
+	}
+
+	/* integer blend of the colour channels, no float round trip of the destination */
+	static void blend(storage_type & dst, Vec4f const & src)
+	{
+		uint32_t const a = unorm8(src.w()), s = encode(src);
+		uint32_t res = 0xff000000;
+		for (int shift = 0; shift < 24; shift += 8)
+		{
+			uint32_t const c = ((dst >> shift) & 0xff) * (255 - a) + ((s >> shift) & 0xff) * a;
+			res |= ((c + 127) / 255) << shift;
+		}
+		dst = res;
+	}
+
+	/* channels summed in 16 bit lanes and rounded, count is a power of two */
+	static storage_type resolve(storage_type const * samples, int count)
+	{
+		int shift = 0;
+		while ((1 << shift) < count) ++shift;
+#ifdef PIXEL_FORMAT_SSE2
+		if (count % 4 == 0)
+		{
+			__m128i const zero = _mm_setzero_si128();
+			__m128i sum = zero;
+			for (int s = 0; s < count; s += 4)
+			{
+				__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(samples + s));
+				sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)));
+			}
+			sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+			sum = _mm_srl_epi16(_mm_add_epi16(sum, _mm_set1_epi16(short(count / 2))), _mm_cvtsi32_si128(shift));
+			return storage_type(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+		}
+#endif
+		storage_type res = 0;
+		for (int c = 0; c < 32; c += 8)
+		{
+			uint32_t sum = 0;
+			for (int s = 0; s < count; ++s)
+				sum += (samples[s] >> c) & 0xff;
+			res |= ((sum + count / 2) >> shift) << c;
+		}
+		return res;
+	}
+
+	static RGBA32 to_xrgb8(storage_type v)
+	{
+		return ((v & 0xff) << 16) | (v & 0xff00) | ((v >> 16) & 0xff);
+	}
+
+	static void to_xrgb8(storage_type const * src, RGBA32 * dst, int count)
+	{
+		int i = 0;
+#ifdef PIXEL_FORMAT_SSE2
+		__m128i const low = _mm_set1_epi32(0xff), green = _mm_set1_epi32(0xff00);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i));
+			__m128i const r = _mm_slli_epi32(_mm_and_si128(v, low), 16);
+			__m128i const b = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(_mm_or_si128(r, _mm_and_si128(v, green)), b));
+		}
+#endif
+		to_xrgb8_each<RGBA8>(src + i, dst + i, count - i);
+	}
+};
+
+/* 10 bits per colour channel from the lowest bits up, 2 bits of alpha on top */
+struct RGB10A2
+{
+	using storage_type = uint32_t;
+
+	static storage_type encode(Vec4f const & color)
+	{
+		auto const unorm10 = [](float c) { return uint32_t(saturate(c) * 1023.0f + 0.5f); };
+		return unorm10(color.x()) | (unorm10(color.y()) << 10) | (unorm10(color.z()) << 20)
+			| (uint32_t(saturate(color.w()) * 3.0f + 0.5f) << 30);
+	}
+
+	static Vec4f decode(storage_type v)
+	{
+		float const s = 1.0f / 1023.0f;
+		return Vec4f{ float(v & 0x3ff) * s, float((v >> 10) & 0x3ff) * s, float((v >> 20) & 0x3ff) * s, float(v >> 30) * (1.0f / 3.0f) };
+	}
+
+	static void blend(storage_type & dst, Vec4f const & src)
+	{
+		blend_decoded<RGB10A2>(dst, src);
+	}
+
+	static storage_type resolve(storage_type const * samples, int count)
+	{
+		return resolve_decoded<RGB10A2>(samples, count);
+	}
+
+	/* top 8 of the 10 bits */
+	static RGBA32 to_xrgb8(storage_type v)
+	{
+		return (((v >> 2) & 0xff) << 16) | (((v >> 12) & 0xff) << 8) | ((v >> 22) & 0xff);
+	}
+
+	static void to_xrgb8(storage_type const * src, RGBA32 * dst, int count)
+	{
+		to_xrgb8_each<RGB10A2>(src, dst, count);
+	}
+};
+
+/* half floats, for values outside [0, 1] */
+struct RGBA16F
+{
+	struct storage_type
+	{
+		uint16_t c[4];
+	};
+
+	static storage_type encode(Vec4f const & color)
+	{
+		return storage_type{ { float_to_half(color.x()), float_to_half(color.y()), float_to_half(color.z()), float_to_half(color.w()) } };
+	}
+
+	static Vec4f decode(storage_type const & v)
+	{
+		return Vec4f{ half_to_float(v.c[0]), half_to_float(v.c[1]), half_to_float(v.c[2]), half_to_float(v.c[3]) };
+	}
+
+	static void blend(storage_type & dst, Vec4f const & src)
+	{
+		blend_decoded<RGBA16F>(dst, src);
+	}
+
+	static storage_type resolve(storage_type const * samples, int count)
+	{
+		return resolve_decoded<RGBA16F>(samples, count);
+	}
+
+	static RGBA32 to_xrgb8(storage_type const & v)
+	{
+		return RGBA32F::to_xrgb8(decode(v));
+	}
+
+	static void to_xrgb8(storage_type const * src, RGBA32 * dst, int count)
+	{
+		to_xrgb8_each<RGBA16F>(src, dst, count);
+	}
+};
+
+/* depth formats: encode is monotonic, so depth tests and the hierarchical z compare stored values directly */
+
+struct D32F
+{
+	using storage_type = float;
+
+	static storage_type encode(float z) { return z; }
+	static float decode(storage_type d) { return d; }
+};
+
+/* normalized device z in [-1, 1] mapped to [0, 65535] */
+struct D16
+{
+	using storage_type = uint16_t;
+
+	static storage_type encode(float z) { return storage_type(saturate(z * 0.5f + 0.5f) * 65535.0f + 0.5f); }
+	static float decode(storage_type d) { return float(d) * (2.0f / 65535.0f) - 1.0f; }
+};
+
+/* 24 bit unorm in the low bits of a 32 bit word, scaled in double as float cannot hold 2^24 - 1 plus a half */
+struct D24
+{
+	using storage_type = uint32_t;
+
+	static storage_type encode(float z) { return storage_type(double(saturate(z * 0.5f + 0.5f)) * 16777215.0 + 0.5); }
+	static float decode(storage_type d) { return float(double(d) * (2.0 / 16777215.0) - 1.0); }
+};
+
+#endif
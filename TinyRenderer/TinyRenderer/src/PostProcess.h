@@ -0,0 +1,263 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include "Utils.h"
+#include "ThreadPool.h"
+#include "PixelFormat.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define POST_PROCESS_SSE2
+#include <emmintrin.h>
+#endif
+
+/////////////////////////////////
+// screen space anti-aliasing
+/////////////////////////////////
+
+struct FxaaSettings
+{
+	/* a luma range below max(edge_min, edge_threshold * brightest neighbour) is no edge */
+	float edge_threshold = 0.125f;
+	float edge_min = 0.0312f;
+	/* weight of the blend against single pixel features, 0 keeps them sharp */
+	float subpixel = 0.75f;
+};
+
+/* FXAA: pixels whose luma differs enough from their 4 neighbours are blended with the neighbour across the edge,
+   by how close they are to the nearer end of the edge; all other pixels are copied.
+   Edge free pixels are rejected 4 at a time on a row-major luma copy, the full filter runs on the rest. */
+template <typename ColorFormat, typename Layout>
+class Fxaa
+{
+public:
+	using color_type = typename ColorFormat::storage_type;
+
+	Fxaa(int width, int height) :
+		m_width(width), m_height(height),
+		m_luma(width, height),
+		m_output(width, height)
+	{}
+
+	/* rows are split in bands of band_rows, one task each */
+	Buffer2D<color_type, Layout> const & apply(Buffer2D<color_type, Layout> const & src,
+		FxaaSettings const & settings, ThreadPool & thread_pool)
+	{
+		int const band_rows = 8;
+		int const band_cnt = (m_height + band_rows - 1) / band_rows;
+		m_settings = settings;
+
+		thread_pool.parallel_for(band_cnt, [&](int band, int)
+		{
+			int const end_y = (std::min)(m_height, (band + 1) * band_rows);
+			for (int y = band * band_rows; y < end_y; ++y)
+				for (int x = 0; x < m_width; ++x)
+					m_luma.coeff(x, y) = luma(ColorFormat::decode(src.coeff(x, y)));
+		});
+
+		thread_pool.parallel_for(band_cnt, [&](int band, int)
+		{
+			int const end_y = (std::min)(m_height, (band + 1) * band_rows);
+			for (int y = band * band_rows; y < end_y; ++y)
+				filter_row(src, y);
+		});
+		return m_output;
+	}
+
+private:
+	static float luma(Vec4f const & color)
+	{
+		return color.x() * 0.299f + color.y() * 0.587f + color.z() * 0.114f;
+	}
+
+	float luma_at(int x, int y) const
+	{
+		x = (std::min)((std::max)(x, 0), m_width - 1);
+		y = (std::min)((std::max)(y, 0), m_height - 1);
+		return m_luma.coeff(x, y);
+	}
+
+	void filter_row(Buffer2D<color_type, Layout> const & src, int y)
+	{
+		int x = 0;
+#ifdef POST_PROCESS_SSE2
+		/* rows and columns next to the border read clamped neighbours, the scalar path covers them */
+		if (y > 0 && y < m_height - 1)
+		{
+			filter(src, x++, y);
+			float const * row = &m_luma.coeff(0, y);
+			float const * row_up = &m_luma.coeff(0, y + 1);
+			float const * row_down = &m_luma.coeff(0, y - 1);
+			__m128 const edge_min = _mm_set1_ps(m_settings.edge_min);
+			__m128 const edge_threshold = _mm_set1_ps(m_settings.edge_threshold);
+			for (; x + 4 < m_width; x += 4)
+			{
+				__m128 const c = _mm_loadu_ps(row + x), n = _mm_loadu_ps(row_up + x), s = _mm_loadu_ps(row_down + x);
+				__m128 const e = _mm_loadu_ps(row + x + 1), w = _mm_loadu_ps(row + x - 1);
+				__m128 const max_luma = _mm_max_ps(_mm_max_ps(_mm_max_ps(c, n), _mm_max_ps(s, e)), w);
+				__m128 const min_luma = _mm_min_ps(_mm_min_ps(_mm_min_ps(c, n), _mm_min_ps(s, e)), w);
+				__m128 const threshold = _mm_max_ps(edge_min, _mm_mul_ps(max_luma, edge_threshold));
+				int const edges = _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(max_luma, min_luma), threshold));
+				for (int l = 0; l < 4; ++l)
+				{
+					if (edges & (1 << l))
+						filter(src, x + l, y);
+					else
+						m_output.coeff(x + l, y) = src.coeff(x + l, y);
+				}
+			}
+		}
+#endif
+		for (; x < m_width; ++x)
+			filter(src, x, y);
+	}
+
+	void filter(Buffer2D<color_type, Layout> const & src, int x, int y)
+	{
+		float const c = luma_at(x, y);
+		float const n = luma_at(x, y + 1), s = luma_at(x, y - 1), e = luma_at(x + 1, y), w = luma_at(x - 1, y);
+		float const max_luma = (std::max)((std::max)((std::max)(c, n), (std::max)(s, e)), w);
+		float const min_luma = (std::min)((std::min)((std::min)(c, n), (std::min)(s, e)), w);
+		float const range = max_luma - min_luma;
+		if (range < (std::max)(m_settings.edge_min, max_luma * m_settings.edge_threshold))
+		{
+			m_output.coeff(x, y) = src.coeff(x, y);
+			return;
+		}
+
+		float const ne = luma_at(x + 1, y + 1), nw = luma_at(x - 1, y + 1);
+		float const se = luma_at(x + 1, y - 1), sw = luma_at(x - 1, y - 1);
+
+		/* an edge running along x changes luma the most between rows */
+		float const across_rows = std::abs(nw + sw - 2.0f * w) + 2.0f * std::abs(n + s - 2.0f * c) + std::abs(ne + se - 2.0f * e);
+		float const across_columns = std::abs(nw + ne - 2.0f * n) + 2.0f * std::abs(w + e - 2.0f * c) + std::abs(sw + se - 2.0f * s);
+		bool const along_x = across_rows >= across_columns;
+
+		/* the edge lies between this pixel and the neighbour on the steeper side */
+		float const luma_neg = along_x ? s : w, luma_pos = along_x ? n : e;
+		int const side = std::abs(luma_neg - c) >= std::abs(luma_pos - c) ? -1 : 1;
+		float const edge_luma = 0.5f * (c + (side < 0 ? luma_neg : luma_pos));
+		float const gradient = 0.25f * (std::max)(std::abs(luma_neg - c), std::abs(luma_pos - c));
+		int const dx = along_x ? 1 : 0, dy = 1 - dx;
+		int const nx = along_x ? 0 : side, ny = along_x ? side : 0;
+
+		/* walk both ways along the edge until the average of the two pixels beside it leaves the edge luma */
+		auto const pair_luma = [&](int i)
+		{
+			return 0.5f * (luma_at(x + i * dx, y + i * dy) + luma_at(x + i * dx + nx, y + i * dy + ny)) - edge_luma;
+		};
+		static int const steps[] = { 1, 1, 1, 1, 1, 2, 2, 2, 2, 4, 8 };
+		int dist_neg = 0, dist_pos = 0;
+		float end_neg = 0.0f, end_pos = 0.0f;
+		bool done_neg = false, done_pos = false;
+		for (int step : steps)
+		{
+			if (!done_neg)
+			{
+				dist_neg += step;
+				end_neg = pair_luma(-dist_neg);
+				done_neg = std::abs(end_neg) >= gradient;
+			}
+			if (!done_pos)
+			{
+				dist_pos += step;
+				end_pos = pair_luma(dist_pos);
+				done_pos = std::abs(end_pos) >= gradient;
+			}
+			if (done_neg && done_pos) break;
+		}
+
+		/* only the nearer end counts, and only if the edge turns away from this pixel's side there */
+		float const end = dist_neg < dist_pos ? end_neg : end_pos;
+		float blend = 0.0f;
+		if ((end < 0.0f) != (c < edge_luma))
+			blend = 0.5f - float((std::min)(dist_neg, dist_pos)) / float(dist_neg + dist_pos);
+
+		/* single pixel features have a neighbourhood average far from their own luma */
+		float const average = (2.0f * (n + s + e + w) + ne + nw + se + sw) * (1.0f / 12.0f);
+		float const contrast = saturate(std::abs(average - c) / range);
+		float const smooth = (3.0f - 2.0f * contrast) * contrast * contrast;
+		blend = (std::max)(blend, smooth * smooth * m_settings.subpixel);
+
+		int const ox = (std::min)((std::max)(x + nx, 0), m_width - 1);
+		int const oy = (std::min)((std::max)(y + ny, 0), m_height - 1);
+		m_output.coeff(x, y) = ColorFormat::encode(
+			lerp(ColorFormat::decode(src.coeff(x, y)), ColorFormat::decode(src.coeff(ox, oy)), blend));
+	}
+
+	int const m_width;
+	int const m_height;
+	FxaaSettings m_settings;
+	Buffer2D<float> m_luma;
+	Buffer2D<color_type, Layout> m_output;
+};
+
+/////////////////////////////////
+// present
+/////////////////////////////////
+
+/* square cells of a colour target that still owe a lazy clear: those with flag set in cells show value,
+   whatever the target holds there */
+template <typename T>
+struct PendingClear
+{
+	Buffer2D<unsigned char> const & cells;
+	int cell_size;
+	int flag;
+	T value;
+};
+
+/* the bottom-up colour target to 0x00RRGGBB rows of a top-down frame, row y of the target goes to rows[height - 1 - y];
+   converted a run of Layout at a time along each row, in bands of 8 rows run in parallel when a pool is given */
+template <typename ColorFormat, typename Layout>
+void present(Buffer2D<typename ColorFormat::storage_type, Layout> const & src, RGBA32 * const * rows,
+	int width, int height, ThreadPool * thread_pool = nullptr,
+	PendingClear<typename ColorFormat::storage_type> const * pending = nullptr)
+{
+	int const band_rows = 8;
+	int const band_cnt = (height + band_rows - 1) / band_rows;
+	TRACE_SCOPE("present");
+	int const run = Layout::row_run(src.width());
+	RGBA32 const clear_value = pending ? ColorFormat::to_xrgb8(pending->value) : 0;
+	auto const convert = [&](int band, int)
+	{
+		int const end_y = (std::min)(height, (band + 1) * band_rows);
+		for (int y = band * band_rows; y < end_y; ++y)
+		{
+			RGBA32 * dst = rows[height - 1 - y];
+			if (!pending)
+			{
+				for (int x = 0; x < width; x += run)
+					ColorFormat::to_xrgb8(&src.coeff(x, y), dst + x, (std::min)(run, width - x));
+				continue;
+			}
+
+			/* every layout run divides a cell or spans whole ones */
+			int const cell_size = pending->cell_size;
+			int const cell_run = (std::min)(run, cell_size);
+			for (int cell_x = 0; cell_x < width; cell_x += cell_size)
+			{
+				int const end_x = (std::min)(width, cell_x + cell_size);
+				if (pending->cells.coeff(cell_x / cell_size, y / cell_size) & pending->flag)
+				{
+					std::fill(dst + cell_x, dst + end_x, clear_value);
+					continue;
+				}
+				for (int x = cell_x; x < end_x; x += cell_run)
+					ColorFormat::to_xrgb8(&src.coeff(x, y), dst + x, (std::min)(cell_run, end_x - x));
+			}
+		}
+	};
+
+	if (thread_pool)
+	{
+		thread_pool->parallel_for(band_cnt, convert);
+		return;
+	}
+	for (int band = 0; band < band_cnt; ++band)
+		convert(band, 0);
+}
+
+#endif
@@ -2,21 +2,20 @@
 #define RENDER_STAGES_H
 
 #include "Utils.h"
-#include <Eigen\Core>
+#include "ThreadPool.h"
+#include "EdgeFunction.h"
+#include "PixelFormat.h"
+#include "PostProcess.h"
+#include "RenderStats.h"
+#include "Trace.h"
+#include <Eigen/Core>
 #include <algorithm>
 #include <queue>
 #include <vector>
 #include <array>
-
-inline float edge_equation(Vec2f const & p, Vec2f const & v1, Vec2f const & v2)
-{
-	return (p.y() - v2.y()) * (v1.x() - v2.x()) - (p.x() - v2.x()) * (v1.y() - v2.y());
-}
-
-inline bool top_left(Vec2f const & v1, Vec2f const & v2)
-{
-	return (v1.x() <= v2.x()) && (v1.y() <= v2.y());
-}
+#include <type_traits>
+#include <limits>
+#include <memory>
 
 inline Vec3f proj_correct(Vec3f bary, Vec3f const & inv_vertex_w, float inv_frag_w)
 {
@@ -33,34 +32,140 @@ constexpr T clamp(const T& v, const T& lo, const T& hi)
 	return (v <= lo ? lo : (v <= hi ? v : hi));
 }
 
+/* vertex shaders may declare batch_size and a batch operator() shading that many vertices at once */
+template <typename VertexShader, typename = void>
+struct vertex_batch_size
+{
+	static int const value = 1;
+};
+
+template <typename VertexShader>
+struct vertex_batch_size<VertexShader, typename std::enable_if<(VertexShader::batch_size > 1)>::type>
+{
+	static int const value = VertexShader::batch_size;
+};
+
+/* fragment shaders declaring writes_depth = false are depth tested before shading, on the interpolated gl_FragCoord.z */
+template <typename FragmentShader, typename = void>
+struct fragment_writes_depth : std::true_type
+{
+};
+
+template <typename FragmentShader>
+struct fragment_writes_depth<FragmentShader, typename std::enable_if<!FragmentShader::writes_depth>::type> : std::false_type
+{
+};
+
+/* inclusive pixel range, min corner even and max corner odd so that it holds whole quads */
+struct ScreenRect
+{
+	int minx, miny, maxx, maxy;
+};
+
 /////////////////////////////////
 // pipeline
 /////////////////////////////////
 
 template <
 	typename VertexShader, typename FragmentShader, typename Uniform, 
-	typename VSIn, typename VSOut, typename FSIn, typename FSOut
+	typename VSIn, typename VSOut, typename FSIn, typename FSOut,
+	typename ColorFormat = RGBA32F, typename DepthFormat = D32F, typename Layout = RowMajor
 >
 class RenderPipeline
 {
+public:
+	using color_type = typename ColorFormat::storage_type;
+	using depth_type = typename DepthFormat::storage_type;
+
 private:
 	int const m_width;
 	int const m_height;
 
 	float const eps = 1e-20f;
+	/* x and y are clipped only beyond this multiple of the viewport, the rasterizer box clamps the rest */
+	float const guard_band = 4.0f;
+
+	CullMode m_cull_mode = CullMode::Back;
+	FrontFace m_front_face = FrontFace::CW;
+	RenderMode m_render_mode = RenderMode::Color;
+	DepthTest m_depth_test = DepthTest::Less;
 
-	std::vector<VSIn> m_vertex_attri_buffer;
-	std::vector<int> m_vertex_element_buffer;
+	/* borrowed from the caller for the duration of render(), never copied */
+	ArrayView<VSIn> m_vertex_attri_buffer;
+	ArrayView<int> m_vertex_element_buffer;
 
 	std::vector<VSOut> m_post_vs_buffer;
 	std::vector<VSOut> m_post_clip_buffer;
 	std::vector<int> m_post_clip_element_buffer;
+	/* post clip index of each shaded vertex already used by an unclipped triangle, -1 if none yet */
+	std::vector<int> m_post_clip_vertex_map;
+
+	/* VertexShading::Referenced shades on first use through a direct mapped post-transform cache keyed by index */
+	struct VertexCacheEntry
+	{
+		int vertex_id;
+		int post_clip_id;
+		VSOut vsout;
+	};
+	VertexShading m_vertex_shading = VertexShading::All;
+	std::vector<VertexCacheEntry> m_vertex_cache;
+	int m_vertex_cache_hits = 0;
+	int m_vertex_cache_misses = 0;
 
 	//Buffer2D<FSOut> m_per_frag_queue_buffer;
 	//Buffer2D<int> m_per_frag_mark;
 	
-	Buffer2D<Vec4f> m_framebuffer;
-	Buffer2D<float> m_depth_buffer;
+	/* Layout applies to the full resolution targets, linearized by whoever reads them out */
+	Buffer2D<color_type, Layout> m_framebuffer;
+	Buffer2D<depth_type, Layout> m_depth_buffer;
+
+	/* hierarchical z: farthest depth stored in each block_size square cell of m_depth_buffer */
+	Buffer2D<depth_type> m_max_depth_buffer;
+
+	/* lazy clear: the cells of the hierarchical z grid whose pixels still owe the last clear, materialized on first use */
+	enum ClearPending
+	{
+		ClearColor = 1, ClearDepth = 2
+	};
+	bool m_lazy_clear = false;
+	Buffer2D<unsigned char> m_clear_pending;
+	color_type m_clear_color;
+	depth_type m_clear_depth;
+
+	/* multisampling: colour and depth per sample of the current frame, allocated by the first render asking for that many
+	   samples; the colour is resolved into m_framebuffer once when read back, m_samples_dirty until then */
+	static int const max_samples = 8;
+	int m_samples = 1;
+	bool m_samples_dirty = false;
+	SampleBuffer<color_type, Layout> m_sample_color;
+	SampleBuffer<depth_type, Layout> m_sample_depth;
+
+	/* sort-middle rasterization: primitives binned into square tiles, each tile owned by one worker */
+	int m_tile_size = 64;
+	static int const block_size = 8;
+	int m_tile_cols = 0;
+	int m_tile_rows = 0;
+	std::vector<std::vector<int>> m_tile_bins;
+	ThreadPool m_thread_pool;
+
+	/* padded to a cache line per worker so counting does not bounce between cores */
+	struct WorkerCounters
+	{
+		int small_triangles;
+		RenderStats stats;
+		char padding[64];
+	};
+	std::vector<WorkerCounters> m_worker_counters;
+	/* the serial stages count here, the worker counters are added at the end of render() */
+	RenderStats m_stats;
+
+	/* screen space anti-aliasing, allocated by the first post_aa_stage */
+	std::unique_ptr<Fxaa<ColorFormat, Layout>> m_fxaa;
+
+	/* wall clock of the last render(), post_aa_stage() and present_stage(), in milliseconds */
+	float m_render_time = 0.0f;
+	float m_post_aa_time = 0.0f;
+	float m_present_time = 0.0f;
 
 public:
 	RenderPipeline(int width, int height):
@@ -68,125 +173,559 @@ public:
 		//m_per_frag_mark(m_width, m_height),
 		//m_per_frag_queue_buffer(m_width, m_height),
 		m_framebuffer(m_width, m_height),
-		m_depth_buffer(m_width, m_height)
-	{}
+		m_depth_buffer(m_width, m_height),
+		m_max_depth_buffer((m_width + block_size - 1) / block_size, (m_height + block_size - 1) / block_size),
+		m_clear_pending((m_width + block_size - 1) / block_size, (m_height + block_size - 1) / block_size)
+	{
+		set_tile_size(m_tile_size);
+		set_thread_count(1);
+		set_vertex_shading(m_vertex_shading);
+		m_clear_color = ColorFormat::encode(Vec4f::Zero());
+		m_clear_depth = DepthFormat::encode(1.0f);
+	}
 
-	void clear_pipeline(Vec4f color)
+	/* tile edge length in pixels, rounded up to whole blocks so that no hierarchical z cell spans two tiles */
+	void set_tile_size(int tile_size)
+	{
+		m_tile_size = (std::max)(1, (tile_size + block_size - 1) / block_size) * block_size;
+		m_tile_cols = (m_width + m_tile_size - 1) / m_tile_size;
+		m_tile_rows = (m_height + m_tile_size - 1) / m_tile_size;
+		m_tile_bins.assign(m_tile_cols * m_tile_rows, {});
+	}
+
+	/* 1 rasterizes on the calling thread only */
+	void set_thread_count(int thread_count)
+	{
+		m_thread_pool.resize((std::max)(1, thread_count));
+		m_worker_counters.assign(m_thread_pool.size(), {});
+	}
+
+	/* default culls counter-clockwise triangles, the winding the rasterizer used to skip */
+	void set_cull_mode(CullMode cull_mode, FrontFace front_face)
+	{
+		m_cull_mode = cull_mode;
+		m_front_face = front_face;
+	}
+
+	/* per draw state, kept until changed, e.g. a DepthOnly prepass followed by a Color pass with DepthTest::Equal */
+	void set_render_mode(RenderMode render_mode)
+	{
+		m_render_mode = render_mode;
+	}
+
+	void set_depth_test(DepthTest depth_test)
+	{
+		m_depth_test = depth_test;
+	}
+
+	/* shadow maps read the depth of a DepthOnly draw from here; after a multisampled render() a pixel holds the nearest
+	   depth of its samples */
+	Buffer2D<depth_type, Layout> const & depth_buffer()
+	{
+		resolve_clears(ClearDepth);
+		if (m_samples > 1)
+			resolve_sample_depth();
+		return m_depth_buffer;
+	}
+
+	/* the colour target for reading back, the one render() returns may still owe lazy clears and the MSAA resolve */
+	Buffer2D<color_type, Layout> const & color_buffer()
+	{
+		resolve_clears(ClearColor);
+		resolve_samples();
+		return m_framebuffer;
+	}
+
+	/* cache_size is rounded up to a power of two, only used by VertexShading::Referenced */
+	void set_vertex_shading(VertexShading vertex_shading, int cache_size = 256)
+	{
+		int size = 1;
+		while (size < cache_size) size <<= 1;
+		m_vertex_shading = vertex_shading;
+		m_vertex_cache.resize(size);
+	}
+
+	/* post-transform cache hits over vertex fetches of the last render() */
+	float vertex_cache_hit_rate() const
+	{
+		int const fetch_cnt = m_vertex_cache_hits + m_vertex_cache_misses;
+		return fetch_cnt == 0 ? 0.0f : float(m_vertex_cache_hits) / fetch_cnt;
+	}
+
+	int tile_size() const { return m_tile_size; }
+	int thread_count() const { return m_thread_pool.size(); }
+
+	/* triangles drawn by the small triangle path since the last clear_pipeline */
+	int small_triangle_count() const
+	{
+		int cnt = 0;
+		for (auto const & counters : m_worker_counters)
+			cnt += counters.small_triangles;
+		return cnt;
+	}
+
+	/* counters and stage timings of the last render(), all zero unless built with RENDER_STATS=1 */
+	RenderStats const & stats() const { return m_stats; }
+
+	float render_time() const { return m_render_time; }
+	float post_aa_time() const { return m_post_aa_time; }
+	float present_time() const { return m_present_time; }
+
+	/* clear_pipeline only flags cells, untouched cells are never written: present_stage() shows the clear colour for them,
+	   color_buffer() and depth_buffer() fill them in when read back */
+	void set_lazy_clear(bool lazy_clear)
+	{
+		resolve_clears(ClearColor | ClearDepth);
+		m_lazy_clear = lazy_clear;
+	}
+
+	/* the colour is not used yet, targets clear to transparent black */
+	void clear_pipeline(Vec4f /*color*/)
 	{
 		m_post_vs_buffer.clear();
-		m_post_clip_buffer.clear();
-		m_post_clip_element_buffer.clear();
+		for (auto & counters : m_worker_counters)
+			counters = {};
 
 		//m_per_frag_mark.clear(0);
 		//m_per_frag_queue_buffer.clear(FSOut{ 1.0f, color });
-		m_framebuffer.clear(Vec4f::Zero());
-		m_depth_buffer.clear(1.0f);
+		m_clear_color = ColorFormat::encode(Vec4f::Zero());
+		m_clear_depth = DepthFormat::encode(1.0f);
+		m_max_depth_buffer.clear(m_clear_depth);
+		m_samples_dirty = false;
+		if (m_lazy_clear)
+		{
+			m_clear_pending.clear(ClearColor | ClearDepth);
+			return;
+		}
+		m_framebuffer.clear(m_clear_color);
+		m_depth_buffer.clear(m_clear_depth);
+		m_sample_color.clear(m_clear_color);
+		m_sample_depth.clear(m_clear_depth);
 	}
 
-	void input_assembly_stage(std::vector<VSIn> const & inputs, std::vector<int> const & elements)
+	void input_assembly_stage(ArrayView<VSIn> inputs, ArrayView<int> elements)
 	{
+		TRACE_SCOPE("input_assembly_stage");
 		m_vertex_attri_buffer = inputs;
 		m_vertex_element_buffer = elements;
 	}
 
 	void vertex_shading_stage(Uniform const & uni) 
 	{
-		for (auto const & vsin : m_vertex_attri_buffer)
-			m_post_vs_buffer.push_back(VertexShader()(vsin, uni));
+		TRACE_SCOPE("vertex_shading_stage");
+		RENDER_STAT_ADD(m_stats, vertices_in, m_vertex_attri_buffer.size());
+		/* deferred to primitive assembly */
+		if (m_vertex_shading == VertexShading::Referenced) return;
+
+		int const vertex_cnt = int(m_vertex_attri_buffer.size());
+		int const vertex_batch = 4096;
+		m_post_vs_buffer.resize(vertex_cnt);
+		RENDER_STAT_ADD(m_stats, vertices_shaded, vertex_cnt);
+
+		m_thread_pool.parallel_for((vertex_cnt + vertex_batch - 1) / vertex_batch, [&](int batch, int)
+		{
+			int const end = (std::min)(vertex_cnt, (batch + 1) * vertex_batch);
+			shade_vertices(batch * vertex_batch, end, uni,
+				std::integral_constant<bool, (vertex_batch_size<VertexShader>::value > 1)>());
+		});
 	}
 
-	void primitive_assembly_stage()
+	void primitive_assembly_stage(Uniform const & uni)
 	{
-		/* clip */
-		for (int i = 0; i < m_vertex_element_buffer.size() / 3; ++i)
-			clip_primitive(i);
-		/* cull */
+		TRACE_SCOPE("primitive_assembly_stage");
+		int const prim_cnt = int(m_vertex_element_buffer.size() / 3);
+		RENDER_STAT_ADD(m_stats, triangles_in, prim_cnt);
 
+		if (m_vertex_shading == VertexShading::Referenced)
+		{
+			for (auto & entry : m_vertex_cache)
+				entry.vertex_id = -1;
+			m_vertex_cache_hits = m_vertex_cache_misses = 0;
+
+			for (int i = 0; i < prim_cnt; ++i)
+			{
+				VertexCacheEntry uncached[3];
+				VertexCacheEntry * entry[3];
+				for (int k = 0; k < 3; ++k)
+					entry[k] = &fetch_vertex(m_vertex_element_buffer[i * 3 + k], uni, entry, k, uncached[k]);
+
+				VSOut const * const v[3] = { &entry[0]->vsout, &entry[1]->vsout, &entry[2]->vsout };
+				int * const post_clip_id[3] = { &entry[0]->post_clip_id, &entry[1]->post_clip_id, &entry[2]->post_clip_id };
+				if (cull_primitive(v))
+				{
+					RENDER_STAT_ADD(m_stats, triangles_culled, 1);
+					continue;
+				}
+				clip_primitive(v, post_clip_id);
+			}
+			RENDER_STAT_ADD(m_stats, vertices_shaded, m_vertex_cache_misses);
+			return;
+		}
+
+		m_post_clip_vertex_map.assign(m_post_vs_buffer.size(), -1);
+		for (int i = 0; i < prim_cnt; ++i)
+		{
+			int const vid[3] = {
+				m_vertex_element_buffer[i * 3],
+				m_vertex_element_buffer[i * 3 + 1],
+				m_vertex_element_buffer[i * 3 + 2] };
+			VSOut const * const v[3] = { &m_post_vs_buffer[vid[0]], &m_post_vs_buffer[vid[1]], &m_post_vs_buffer[vid[2]] };
+			int * const post_clip_id[3] = {
+				&m_post_clip_vertex_map[vid[0]], &m_post_clip_vertex_map[vid[1]], &m_post_clip_vertex_map[vid[2]] };
+
+			/* cull */
+			if (cull_primitive(v))
+			{
+				RENDER_STAT_ADD(m_stats, triangles_culled, 1);
+				continue;
+			}
+			/* clip */
+			clip_primitive(v, post_clip_id);
+		}
 	}
 	
 	void rasterization_stage_and_fragment_shading_stage_post_process_stage(Uniform const & uni, MSAA msaa)
 	{
+		TRACE_SCOPE("rasterization_stage");
+		StatsTimer timer;
 		/* projection divide and viewport transform */
-		for (auto & vsout : m_post_clip_buffer)
-			projection_divide_and_view_port_transform(vsout);
+		int const vertex_cnt = int(m_post_clip_buffer.size());
+		int const vertex_batch = 4096;
+		m_thread_pool.parallel_for((vertex_cnt + vertex_batch - 1) / vertex_batch, [&](int batch, int)
+		{
+			int const end = (std::min)(vertex_cnt, (batch + 1) * vertex_batch);
+			for (int i = batch * vertex_batch; i < end; ++i)
+				projection_divide_and_view_port_transform(m_post_clip_buffer[i]);
+		});
+		RENDER_STAT_ADD(m_stats, setup_ns, timer.lap());
+
+		int const prim_cnt = int(m_post_clip_element_buffer.size() / 3);
+		ScreenRect const screen = { 0, 0, m_width - 1, m_height - 1 };
 
 		/* rasterize primitive */
-		for (int i = 0; i < m_post_clip_element_buffer.size() / 3; ++i)
-			rasterize_triangle_and_fragment_shading_and_post_process(
-				m_post_clip_buffer[m_post_clip_element_buffer[i * 3]],
-				m_post_clip_buffer[m_post_clip_element_buffer[i * 3 + 1]],
-				m_post_clip_buffer[m_post_clip_element_buffer[i * 3 + 2]],
-				uni, msaa);
+		if (m_thread_pool.size() == 1)
+		{
+			for (int i = 0; i < prim_cnt; ++i)
+				rasterize_primitive(i, uni, msaa, screen, 0);
+			RENDER_STAT_ADD(m_stats, raster_ns, timer.lap());
+			return;
+		}
+
+		/* bin primitives in submission order, so blending inside a tile keeps the serial result */
+		{
+			TRACE_SCOPE("binning");
+			for (auto & bin : m_tile_bins)
+				bin.clear();
+			for (int i = 0; i < prim_cnt; ++i)
+			{
+				ScreenRect box;
+				if (!bounding_box(i, box)) continue;
+				for (int ty = box.miny / m_tile_size; ty <= box.maxy / m_tile_size; ++ty)
+					for (int tx = box.minx / m_tile_size; tx <= box.maxx / m_tile_size; ++tx)
+						m_tile_bins[ty * m_tile_cols + tx].push_back(i);
+			}
+		}
+		RENDER_STAT_ADD(m_stats, binning_ns, timer.lap());
+
+		m_thread_pool.parallel_for(int(m_tile_bins.size()), [&](int tile_id, int worker_id)
+		{
+			TRACE_SCOPE_ARG("tile", "tile", tile_id);
+			int const tx = tile_id % m_tile_cols, ty = tile_id / m_tile_cols;
+			ScreenRect const tile = {
+				tx * m_tile_size, ty * m_tile_size,
+				(std::min)(m_width - 1, (tx + 1) * m_tile_size - 1),
+				(std::min)(m_height - 1, (ty + 1) * m_tile_size - 1) };
+			for (int prim_id : m_tile_bins[tile_id])
+				rasterize_primitive(prim_id, uni, msaa, tile, worker_id);
+		});
+		RENDER_STAT_ADD(m_stats, raster_ns, timer.lap());
 	}
 
-	Buffer2D<Vec4f> const & render(std::vector<VSIn> const & inputs, std::vector<int> const & elements, 
+	/* inputs and elements are read in place, std::vector converts implicitly;
+	   the msaa mode is expected to stay the same between two clear_pipeline calls;
+	   with lazy clear, cells nothing drew to keep stale pixels in the result until color_buffer() fills them,
+	   with MSAA the result is only resolved by color_buffer(), post_aa_stage() or present_stage() */
+	Buffer2D<color_type, Layout> const & render(ArrayView<VSIn> inputs, ArrayView<int> elements, 
 		Uniform const & uni, MSAA msaa)
 	{
+		TRACE_SCOPE("render");
+		auto const start = std::chrono::steady_clock::now();
+		m_samples = sample_count(msaa);
+		if (m_samples > 1 && m_sample_color.sample_count() != m_samples)
+		{
+			m_sample_color.resize(m_width, m_height, m_samples, m_clear_color);
+			m_sample_depth.resize(m_width, m_height, m_samples, m_clear_depth);
+		}
+
+		/* draws of the same frame share nothing but the targets */
+		m_post_clip_buffer.clear();
+		m_post_clip_element_buffer.clear();
+
+		m_stats = RenderStats();
+		for (auto & counters : m_worker_counters)
+			counters.stats = RenderStats();
+		StatsTimer timer;
+
 		input_assembly_stage(inputs, elements);
 		vertex_shading_stage(uni);
-		primitive_assembly_stage();
+		RENDER_STAT_ADD(m_stats, vertex_ns, timer.lap());
+		/* includes the vertex shading deferred by VertexShading::Referenced */
+		primitive_assembly_stage(uni);
+		RENDER_STAT_ADD(m_stats, primitive_ns, timer.lap());
+		/* times its own steps */
 		rasterization_stage_and_fragment_shading_stage_post_process_stage(uni, msaa);
+		m_samples_dirty = m_samples > 1;
 
+		for (auto const & counters : m_worker_counters)
+			m_stats += counters.stats;
+		auto const elapsed = std::chrono::steady_clock::now() - start;
+		RENDER_STAT_ADD(m_stats, total_ns, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+		m_render_time = std::chrono::duration<float, std::milli>(elapsed).count();
 		return m_framebuffer;
 	}
 
+	/* FXAA over the colour target, once after the last render() of a frame, as a cheaper alternative to MSAA;
+	   the result goes to a separate buffer, m_framebuffer keeps the aliased image for further draws */
+	Buffer2D<color_type, Layout> const & post_aa_stage(FxaaSettings const & settings = FxaaSettings())
+	{
+		TRACE_SCOPE("post_aa_stage");
+		auto const start = std::chrono::steady_clock::now();
+		resolve_clears(ClearColor);
+		resolve_samples();
+		if (!m_fxaa)
+			m_fxaa.reset(new Fxaa<ColorFormat, Layout>(m_width, m_height));
+		auto const & res = m_fxaa->apply(m_framebuffer, settings, m_thread_pool);
+		m_post_aa_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return res;
+	}
+
+	/* the result of render() or post_aa_stage() into the top-down rows of a width by height 0x00RRGGBB frame,
+	   e.g. device_t::framebuffer, on the worker threads */
+	void present_stage(Buffer2D<color_type, Layout> const & buffer, RGBA32 * const * rows, int width, int height)
+	{
+		auto const start = std::chrono::steady_clock::now();
+		PendingClear<color_type> const pending = { m_clear_pending, block_size, ClearColor, m_clear_color };
+		bool const owes_clear = m_lazy_clear && &buffer == &m_framebuffer;
+		if (&buffer == &m_framebuffer)
+			resolve_samples();
+		present<ColorFormat, Layout>(buffer, rows, width, height, &m_thread_pool, owes_clear ? &pending : nullptr);
+		m_present_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
 private:
-	void clip_primitive(size_t prim_id)
+	/* per triangle constants shared by the block and quad levels of the rasterizer */
+	struct TriangleSetup
 	{
-		bool need_last = false;
-		std::vector<VSOut> post_clip_prim_buffer;
-		for (int eid = 0; eid < 3; ++eid) /* for each triangle edge */
+		VSOut const & vsout0;
+		VSOut const & vsout1;
+		VSOut const & vsout2;
+		Vec3f inv_vertex_w;
+		Vec3f vertex_z;
+		/* nearest depth of the triangle, see hierarchical_z() for when it bounds fragment depths */
+		depth_type min_depth;
+		EdgeSetup edge;
+		float inv_area;
+		bool front_facing;
+		/* counters of the worker rasterizing the triangle */
+		RenderStats * stats;
+		/* edge value offsets of the sample positions, and z / w at the vertices for depth at a sample, set by init_samples */
+		float sample_delta[max_samples][3];
+		Vec3f z_over_w;
+	};
+
+	/* covered samples of the lanes of a quad, and their depths once the early z test computed them */
+	struct QuadSamples
+	{
+		int mask[4];
+		depth_type depth[4][max_samples];
+	};
+
+	void shade_vertices(int begin, int end, Uniform const & uni, std::false_type)
+	{
+		for (int i = begin; i < end; ++i)
+			m_post_vs_buffer[i] = VertexShader()(m_vertex_attri_buffer[i], uni);
+	}
+
+	void shade_vertices(int begin, int end, Uniform const & uni, std::true_type)
+	{
+		int const batch = vertex_batch_size<VertexShader>::value;
+		for (; begin + batch <= end; begin += batch)
+			VertexShader()(&m_vertex_attri_buffer[begin], &m_post_vs_buffer[begin], uni);
+		shade_vertices(begin, end, uni, std::false_type());
+	}
+
+	/* facing from the determinant of clip space (x, y, w), valid whatever the signs of w, so it runs before clipping */
+	bool cull_primitive(VSOut const * const (&v)[3]) const
+	{
+		auto const & p0 = v[0]->gl_Position;
+		auto const & p1 = v[1]->gl_Position;
+		auto const & p2 = v[2]->gl_Position;
+
+		float const det =
+			p0.x() * (p1.y() * p2.w() - p1.w() * p2.y())
+			- p0.y() * (p1.x() * p2.w() - p1.w() * p2.x())
+			+ p0.w() * (p1.x() * p2.y() - p1.y() * p2.x());
+
+		/* degenerate, zero area or seen edge on */
+		if (!(std::abs(det) > eps)) return true;
+		if (m_cull_mode == CullMode::None) return false;
+
+		bool const front_facing = (det > 0.0f) == (m_front_face == FrontFace::CCW);
+		return front_facing == (m_cull_mode == CullMode::Front);
+	}
+
+	enum ClipPlane
+	{
+		ClipNear = 1 << 0, ClipFar = 1 << 1,
+		ClipLeft = 1 << 2, ClipRight = 1 << 3, ClipBottom = 1 << 4, ClipTop = 1 << 5,
+		GuardLeft = 1 << 6, GuardRight = 1 << 7, GuardBottom = 1 << 8, GuardTop = 1 << 9,
+	};
+	static int const clip_plane_cnt = 10;
+	/* a convex triangle cut by near, far and the four guard planes gains at most one vertex per plane */
+	static int const max_clip_vertex_cnt = 3 + 6;
+
+	/* signed distance to a clip plane, inside when not negative */
+	float clip_distance(Vec4f const & p, int plane) const
+	{
+		switch (plane)
 		{
-			auto const & v0 = m_post_vs_buffer[m_vertex_element_buffer[prim_id * 3 + eid % 3]];
-			auto const & v1 = m_post_vs_buffer[m_vertex_element_buffer[prim_id * 3 + (eid + 1) % 3]];
-
-			auto const & vp0 = v0.gl_Position;
-			auto const & vp1 = v1.gl_Position;
-
-			/* insert vertex */
-			std::vector<float> interp_vertex_t;
-			//interp_vertex_t.push_back(0.0f);
-			/* w = z */
-			float det = (vp1.z() - vp0.z()) - (vp1.w() - vp0.w());
-			if (std::abs(det) > eps)
-			{
-				auto tmp = (vp0.w() - vp0.z()) / det;
-				if (0.0f < tmp && tmp < 1.0f) interp_vertex_t.push_back(tmp);
-			}
-			/* w = -z */
-			det = (vp1.z() - vp0.z()) + (vp1.w() - vp0.w());
-			if (std::abs(det) > eps)
+		case ClipNear: return p.w() + p.z();
+		case ClipFar: return p.w() - p.z();
+		case ClipLeft: return p.w() + p.x();
+		case ClipRight: return p.w() - p.x();
+		case ClipBottom: return p.w() + p.y();
+		case ClipTop: return p.w() - p.y();
+		case GuardLeft: return guard_band * p.w() + p.x();
+		case GuardRight: return guard_band * p.w() - p.x();
+		case GuardBottom: return guard_band * p.w() + p.y();
+		case GuardTop: return guard_band * p.w() - p.y();
+		default: return 0.0f;
+		}
+	}
+
+	int clip_code(Vec4f const & p) const
+	{
+		int code = 0;
+		for (int i = 0; i < clip_plane_cnt; ++i)
+			if (clip_distance(p, 1 << i) < 0.0f) code |= 1 << i;
+		return code;
+	}
+
+	/* the entry of vertex_id, shaded on a miss; a slot taken by an earlier vertex of the same triangle is left alone */
+	VertexCacheEntry & fetch_vertex(int vertex_id, Uniform const & uni,
+		VertexCacheEntry * const (&triangle_entry)[3], int k, VertexCacheEntry & uncached)
+	{
+		VertexCacheEntry * entry = &m_vertex_cache[vertex_id & (m_vertex_cache.size() - 1)];
+		for (int j = 0; j < k; ++j)
+			if (triangle_entry[j] == entry && entry->vertex_id != vertex_id)
 			{
-				auto tmp = (-vp0.w() - vp0.z()) / det;
-				if (0.0f < tmp && tmp < 1.0f) interp_vertex_t.push_back(tmp);
+				/* a stack slot, whatever it holds is not a shaded vertex of this draw */
+				entry = &uncached;
+				entry->vertex_id = -1;
 			}
-			if (interp_vertex_t.size() == 2 && interp_vertex_t[0] > interp_vertex_t[1])
-				std::swap(interp_vertex_t[0], interp_vertex_t[1]);
-			//interp_vertex_t.push_back(1.0f);
-
-			auto between_near_and_far = [](Vec4f const p) { return std::abs(p.w()) > std::abs(p.z()); };
-			if (between_near_and_far(vp0)) 
-				post_clip_prim_buffer.push_back(v0);
-			for (auto t : interp_vertex_t)
+
+		if (entry->vertex_id == vertex_id)
+		{
+			m_vertex_cache_hits += 1;
+			return *entry;
+		}
+
+		m_vertex_cache_misses += 1;
+		entry->vertex_id = vertex_id;
+		entry->post_clip_id = -1;
+		entry->vsout = VertexShader()(m_vertex_attri_buffer[vertex_id], uni);
+		return *entry;
+	}
+
+	int post_clip_vertex(VSOut const & v, int & post_clip_id)
+	{
+		if (post_clip_id < 0)
+		{
+			post_clip_id = int(m_post_clip_buffer.size());
+			m_post_clip_buffer.push_back(v);
+		}
+		return post_clip_id;
+	}
+
+	/* post_clip_id[k] remembers where v[k] went in m_post_clip_buffer, so unclipped triangles share vertices */
+	void clip_primitive(VSOut const * const (&v)[3], int * const (&post_clip_id)[3])
+	{
+		int const code0 = clip_code(v[0]->gl_Position);
+		int const code1 = clip_code(v[1]->gl_Position);
+		int const code2 = clip_code(v[2]->gl_Position);
+
+		/* trivial reject, all vertices outside one frustum plane */
+		if (code0 & code1 & code2)
+		{
+			RENDER_STAT_ADD(m_stats, triangles_rejected, 1);
+			return;
+		}
+
+		/* trivial accept, inside near, far and the guard band: shared vertices are copied once and reused */
+		int const cut_planes = (code0 | code1 | code2) & ~(ClipLeft | ClipRight | ClipBottom | ClipTop);
+		if (cut_planes == 0)
+		{
+			for (int i = 0; i < 3; ++i)
+				m_post_clip_element_buffer.push_back(post_clip_vertex(*v[i], *post_clip_id[i]));
+			RENDER_STAT_ADD(m_stats, triangles_emitted, 1);
+			return;
+		}
+		RENDER_STAT_ADD(m_stats, triangles_clipped, 1);
+
+		/* Sutherland-Hodgman against the planes actually crossed, in fixed stack storage */
+		VSOut poly[2][max_clip_vertex_cnt];
+		int cnt = 3;
+		for (int i = 0; i < 3; ++i)
+			poly[0][i] = *v[i];
+
+		int cur = 0;
+		for (int plane = 1; plane < (1 << clip_plane_cnt) && cnt >= 3; plane <<= 1)
+		{
+			if ((cut_planes & plane) == 0) continue;
+
+			VSOut const * in = poly[cur];
+			VSOut * out = poly[1 - cur];
+			int out_cnt = 0;
+			for (int i = 0; i < cnt; ++i)
 			{
-				post_clip_prim_buffer.push_back(lerp(v0, v1, t));
+				VSOut const & v0 = in[i];
+				VSOut const & v1 = in[(i + 1) % cnt];
+				float const d0 = clip_distance(v0.gl_Position, plane);
+				float const d1 = clip_distance(v1.gl_Position, plane);
+
+				bool const keep = d0 >= 0.0f, cut = (d0 >= 0.0f) != (d1 >= 0.0f);
+				/* vertices lerped on an earlier plane may leave a sliver slightly non-convex, so that it gains more than
+				   one vertex on this one; such a sliver is dropped rather than written past poly */
+				if (out_cnt + int(keep) + int(cut) > max_clip_vertex_cnt)
+				{
+					out_cnt = 0;
+					break;
+				}
+				if (keep)
+					out[out_cnt++] = v0;
+				if (cut)
+					out[out_cnt++] = lerp(v0, v1, d0 / (d0 - d1));
 			}
+			cnt = out_cnt;
+			cur = 1 - cur;
 		}
 
-		if (post_clip_prim_buffer.size() < 3) return;
+		if (cnt < 3)
+		{
+			RENDER_STAT_ADD(m_stats, triangles_rejected, 1);
+			return;
+		}
+		RENDER_STAT_ADD(m_stats, triangles_emitted, cnt - 2);
 
-		int start_id = m_post_clip_buffer.size();
-		m_post_clip_buffer.insert(m_post_clip_buffer.end(), 
-			post_clip_prim_buffer.begin(), post_clip_prim_buffer.end());
-		int end_id = m_post_clip_buffer.size() - 1;
+		int const start_id = int(m_post_clip_buffer.size());
+		m_post_clip_buffer.insert(m_post_clip_buffer.end(), poly[cur], poly[cur] + cnt);
 
-		for (int i = start_id + 1; i < end_id; ++i)
+		for (int i = start_id + 1; i < start_id + cnt - 1; ++i)
 		{
 			m_post_clip_element_buffer.push_back(start_id);
 			m_post_clip_element_buffer.push_back(i);
 			m_post_clip_element_buffer.push_back(i + 1);
 		}
-
 	}
 
 	void projection_divide_and_view_port_transform(VSOut & vsout)
@@ -199,44 +738,272 @@ private:
 		vsout.gl_Position.y() = vsout.gl_Position.y() * (m_height / 2) + m_height / 2;
 	}
 
-	void rasterize_triangle_and_fragment_shading_and_post_process(
-		VSOut const & vsout0, VSOut const & vsout1, VSOut const & vsout2, Uniform const & uni, MSAA aa_mode)
+	/* screen bounding box of the pixels whose centre, or any sample when multisampling, a post-clip primitive can cover,
+	   expanded to whole quads on the even quad grid; false when it covers none */
+	bool bounding_box(int prim_id, ScreenRect & box) const
 	{
-		auto v0 = vsout0.gl_Position, v1 = vsout1.gl_Position, v2 = vsout2.gl_Position;
-		
-		Vec2f sv0 = { v0.x(), v0.y() }, sv1 = { v1.x(), v1.y() }, sv2 = { v2.x(), v2.y() };
-		Vec3f inv_vertex_w = { 1.0f / v0.w(), 1.0f / v1.w(), 1.0f / v2.w() };
+		auto const & v0 = m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3]].gl_Position;
+		auto const & v1 = m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3 + 1]].gl_Position;
+		auto const & v2 = m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3 + 2]].gl_Position;
 
-		float x1 = sv0.x(), x2 = sv1.x(), x3 = sv2.x();
-		float y1 = sv0.y(), y2 = sv1.y(), y3 = sv2.y();
+		float x1 = v0.x(), x2 = v1.x(), x3 = v2.x();
+		float y1 = v0.y(), y2 = v1.y(), y3 = v2.y();
 
-		int minx = (std::max)(0, int(std::floor((std::min)(x1, (std::min)(x2, x3)))));
-		int miny = (std::max)(0, int(std::floor((std::min)(y1, (std::min)(y2, y3)))));
-		int maxx = (std::min)(m_width - 1, int(std::ceil((std::max)(x1, (std::max)(x2, x3)))));
-		int maxy = (std::min)(m_height - 1, int(std::ceil((std::max)(y1, (std::max)(y2, y3)))));
+		/* pixel x has its centre at x + 0.5, the sample patterns stay within half a pixel of it */
+		float const reach = m_samples > 1 ? 0.5f : 0.0f;
+		box.minx = (std::max)(0, int(std::ceil((std::min)(x1, (std::min)(x2, x3)) - 0.5f - reach)));
+		box.miny = (std::max)(0, int(std::ceil((std::min)(y1, (std::min)(y2, y3)) - 0.5f - reach)));
+		box.maxx = (std::min)(m_width - 1, int(std::floor((std::max)(x1, (std::max)(x2, x3)) - 0.5f + reach)));
+		box.maxy = (std::min)(m_height - 1, int(std::floor((std::max)(y1, (std::max)(y2, y3)) - 0.5f + reach)));
 
-		if (minx >= maxx || miny >= maxy) return;
+		if (box.minx > box.maxx || box.miny > box.maxy) return false;
+
+		/* m_width and m_height are even, so the expanded box stays on screen */
+		box.minx &= ~1; box.miny &= ~1;
+		box.maxx |= 1; box.maxy |= 1;
+		return true;
+	}
 
-		if ((maxx - minx + 1) % 2 == 1)
+	void rasterize_primitive(int prim_id, Uniform const & uni, MSAA aa_mode, ScreenRect const & clip_rect, int worker_id)
+	{
+		ScreenRect box;
+		if (!bounding_box(prim_id, box)) return;
+		RenderStats & stats = m_worker_counters[worker_id].stats;
+
+		VSOut const * vsout0 = &m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3]];
+		VSOut const * vsout1 = &m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3 + 1]];
+		VSOut const * vsout2 = &m_post_clip_buffer[m_post_clip_element_buffer[prim_id * 3 + 2]];
+
+		/* edge values are positive inside clockwise triangles only, so the other winding is walked with two vertices swapped */
+		Vec2f const sv0 = { vsout0->gl_Position.x(), vsout0->gl_Position.y() };
+		Vec2f const sv1 = { vsout1->gl_Position.x(), vsout1->gl_Position.y() };
+		Vec2f const sv2 = { vsout2->gl_Position.x(), vsout2->gl_Position.y() };
+		bool const clockwise = edge_equation(sv0, sv1, sv2) > 0.0f;
+		bool const front_facing = clockwise == (m_front_face == FrontFace::CW);
+		if (!clockwise) std::swap(vsout1, vsout2);
+
+		/* hierarchical z, the whole triangle is behind the farthest depth stored anywhere under its box */
+		if (hierarchical_z())
 		{
-			if (maxx < m_width - 1) maxx += 1;
-			else minx -= 1;
+			depth_type const min_depth = DepthFormat::encode(
+				(std::min)(vsout0->gl_Position.z(), (std::min)(vsout1->gl_Position.z(), vsout2->gl_Position.z())));
+			ScreenRect const rect = {
+				(std::max)(box.minx, clip_rect.minx), (std::max)(box.miny, clip_rect.miny),
+				(std::min)(box.maxx, clip_rect.maxx), (std::min)(box.maxy, clip_rect.maxy) };
+			if (rect.minx > rect.maxx || rect.miny > rect.maxy) return;
+			if (min_depth > max_depth(rect))
+			{
+				RENDER_STAT_ADD(stats, triangles_hiz_rejected, 1);
+				return;
+			}
 		}
-		if ((maxy - miny + 1) % 2 == 1)
+
+		if ((box.maxx - box.minx + 1) * (box.maxy - box.miny + 1) > 8)
 		{
-			if (maxy < m_height - 1) maxy += 1;
-			else miny -= 1;
+			rasterize_triangle_and_fragment_shading_and_post_process(
+				*vsout0, *vsout1, *vsout2, front_facing, uni, aa_mode, box, clip_rect, stats);
+			return;
 		}
 
-		Vec2f line_vec[3];
-		line_vec[0] = sv2 - sv1;
-		line_vec[1] = sv0 - sv2;
-		line_vec[2] = sv1 - sv0;
+		/* counted by the tile holding the box corner only */
+		if (clip_rect.minx <= box.minx && box.minx <= clip_rect.maxx && clip_rect.miny <= box.miny && box.miny <= clip_rect.maxy)
+			m_worker_counters[worker_id].small_triangles += 1;
+		rasterize_small_triangle(*vsout0, *vsout1, *vsout2, front_facing, uni, aa_mode, box, clip_rect, stats);
+	}
+
+	/* the nearest vertex bounds fragment depths only if the shader keeps depth */
+	static bool hierarchical_z()
+	{
+		return !fragment_writes_depth<FragmentShader>::value;
+	}
+
+	/* farthest stored depth over the hierarchical z cells touching rect */
+	depth_type max_depth(ScreenRect const & rect) const
+	{
+		depth_type depth = std::numeric_limits<depth_type>::lowest();
+		for (int cy = rect.miny / block_size; cy <= rect.maxy / block_size; ++cy)
+			for (int cx = rect.minx / block_size; cx <= rect.maxx / block_size; ++cx)
+				depth = (std::max)(depth, m_max_depth_buffer.coeff(cx, cy));
+		return depth;
+	}
 
-		bool is_top_left[3];
-		is_top_left[0] = top_left(sv1, sv2);
-		is_top_left[1] = top_left(sv2, sv0);
-		is_top_left[2] = top_left(sv0, sv1);
+	/* refresh the hierarchical z cells touching rect after depth writes inside it */
+	void update_max_depth(ScreenRect const & rect)
+	{
+		for (int cy = rect.miny / block_size; cy <= rect.maxy / block_size; ++cy)
+			for (int cx = rect.minx / block_size; cx <= rect.maxx / block_size; ++cx)
+			{
+				int const end_x = (std::min)(m_width, (cx + 1) * block_size);
+				int const end_y = (std::min)(m_height, (cy + 1) * block_size);
+				depth_type depth = std::numeric_limits<depth_type>::lowest();
+				for (int y = cy * block_size; y < end_y; ++y)
+					for (int x = cx * block_size; x < end_x; ++x)
+					{
+						if (m_samples == 1)
+						{
+							depth = (std::max)(depth, m_depth_buffer.coeff(x, y));
+							continue;
+						}
+						depth_type const * samples = m_sample_depth.samples(x, y);
+						for (int s = 0; s < m_samples; ++s)
+							depth = (std::max)(depth, samples[s]);
+					}
+				m_max_depth_buffer.coeff(cx, cy) = depth;
+			}
+	}
+
+	/* write the clear values a cell still owes in the buffers selected by mask */
+	void materialize_clear(int cx, int cy, int mask)
+	{
+		unsigned char & pending = m_clear_pending.coeff(cx, cy);
+		int const todo = pending & mask;
+		if (todo == 0) return;
+
+		int const end_x = (std::min)(m_width, (cx + 1) * block_size);
+		int const end_y = (std::min)(m_height, (cy + 1) * block_size);
+		int const sample_cnt = m_sample_color.sample_count();
+		for (int y = cy * block_size; y < end_y; ++y)
+			for (int x = cx * block_size; x < end_x; ++x)
+			{
+				if (todo & ClearColor) m_framebuffer.coeff(x, y) = m_clear_color;
+				if (todo & ClearDepth) m_depth_buffer.coeff(x, y) = m_clear_depth;
+				if (sample_cnt == 0) continue;
+				color_type * colors = m_sample_color.samples(x, y);
+				depth_type * depths = m_sample_depth.samples(x, y);
+				for (int s = 0; s < sample_cnt; ++s)
+				{
+					if (todo & ClearColor) colors[s] = m_clear_color;
+					if (todo & ClearDepth) depths[s] = m_clear_depth;
+				}
+			}
+		pending &= ~todo;
+	}
+
+	void materialize_clear(ScreenRect const & rect)
+	{
+		for (int cy = rect.miny / block_size; cy <= rect.maxy / block_size; ++cy)
+			for (int cx = rect.minx / block_size; cx <= rect.maxx / block_size; ++cx)
+				materialize_clear(cx, cy, ClearColor | ClearDepth);
+	}
+
+	void resolve_clears(int mask)
+	{
+		if (!m_lazy_clear) return;
+		int const cell_cols = (m_width + block_size - 1) / block_size;
+		int const cell_rows = (m_height + block_size - 1) / block_size;
+		m_thread_pool.parallel_for(cell_rows, [&](int cy, int)
+		{
+			for (int cx = 0; cx < cell_cols; ++cx)
+				materialize_clear(cx, cy, mask);
+		});
+	}
+
+	/* average the samples of the frame into m_framebuffer once, after its last render(), cells still owing their clear are
+	   left to resolve_clears; the time goes to the stats of that render() */
+	void resolve_samples()
+	{
+		if (!m_samples_dirty)
+			return;
+		TRACE_SCOPE("resolve");
+		StatsTimer timer;
+		m_samples_dirty = false;
+		int const cell_cols = (m_width + block_size - 1) / block_size;
+		int const cell_rows = (m_height + block_size - 1) / block_size;
+		m_thread_pool.parallel_for(cell_rows, [&](int cy, int)
+		{
+			int const end_y = (std::min)(m_height, (cy + 1) * block_size);
+			for (int cx = 0; cx < cell_cols; ++cx)
+			{
+				if (m_lazy_clear && (m_clear_pending.coeff(cx, cy) & ClearColor)) continue;
+				int const end_x = (std::min)(m_width, (cx + 1) * block_size);
+				for (int y = cy * block_size; y < end_y; ++y)
+					for (int x = cx * block_size; x < end_x; ++x)
+						m_framebuffer.coeff(x, y) = ColorFormat::resolve(m_sample_color.samples(x, y), m_samples);
+			}
+		});
+		RENDER_STAT_ADD(m_stats, resolve_ns, timer.lap());
+	}
+
+	/* the nearest sample depth of each pixel into m_depth_buffer, which multisampled draws do not write */
+	void resolve_sample_depth()
+	{
+		m_thread_pool.parallel_for(m_height, [&](int y, int)
+		{
+			for (int x = 0; x < m_width; ++x)
+			{
+				depth_type const * samples = m_sample_depth.samples(x, y);
+				m_depth_buffer.coeff(x, y) = *std::min_element(samples, samples + m_samples);
+			}
+		});
+	}
+
+	/* standard sample patterns in sixteenths of a pixel */
+	void init_samples(TriangleSetup & tri, int samples) const
+	{
+		static int const pattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+		static int const pattern8[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+		int const (*pattern)[2] = samples == 8 ? pattern8 : pattern4;
+		for (int s = 0; s < samples; ++s) for (int k = 0; k < 3; ++k)
+			tri.sample_delta[s][k] = (pattern[s][0] * tri.edge.step_x[k] + pattern[s][1] * tri.edge.step_y[k]) * (1.0f / 16.0f);
+		tri.z_over_w = tri.inv_vertex_w.cwiseProduct(tri.vertex_z);
+	}
+
+	/* perspective correct depth at sample s of lane l, the barycentric scale cancels out */
+	float sample_depth(TriangleSetup const & tri, float const (&edge_out)[3][4], int l, int s) const
+	{
+		float num = 0.0f, den = 0.0f;
+		for (int k = 0; k < 3; ++k)
+		{
+			float const e = edge_out[k][l] + tri.sample_delta[s][k];
+			num += e * tri.z_over_w[k];
+			den += e * tri.inv_vertex_w[k];
+		}
+		return num / den;
+	}
+
+	/* box of one or two quads: no block level and no stepping, each quad edge value comes straight from the vertices */
+	void rasterize_small_triangle(VSOut const & vsout0, VSOut const & vsout1, VSOut const & vsout2, bool front_facing,
+		Uniform const & uni, MSAA aa_mode, ScreenRect const & box, ScreenRect const & clip_rect, RenderStats & stats)
+	{
+		auto const & v0 = vsout0.gl_Position, & v1 = vsout1.gl_Position, & v2 = vsout2.gl_Position;
+		Vec2f const sv0 = { v0.x(), v0.y() }, sv1 = { v1.x(), v1.y() }, sv2 = { v2.x(), v2.y() };
+
+		TriangleSetup tri = { vsout0, vsout1, vsout2, Vec3f{ 1.0f / v0.w(), 1.0f / v1.w(), 1.0f / v2.w() },
+			Vec3f{ v0.z(), v1.z(), v2.z() }, DepthFormat::encode((std::min)(v0.z(), (std::min)(v1.z(), v2.z()))),
+			EdgeSetup(sv0, sv1, sv2, eps), 1.0f / edge_equation(sv0, sv1, sv2), front_facing,
+			&stats, {}, Vec3f::Zero() };
+		if (aa_mode != MSAA::Standard)
+			init_samples(tri, sample_count(aa_mode));
+
+		int const start_x = (std::max)(box.minx, clip_rect.minx), end_x = (std::min)(box.maxx, clip_rect.maxx);
+		int const start_y = (std::max)(box.miny, clip_rect.miny), end_y = (std::min)(box.maxy, clip_rect.maxy);
+		if (m_lazy_clear && start_x <= end_x && start_y <= end_y)
+			materialize_clear({ start_x, start_y, end_x, end_y });
+
+		bool depth_written = false;
+		for (int y = start_y; y <= end_y - 1; y += 2) for (int x = start_x; x <= end_x - 1; x += 2)
+		{
+			Vec2f const p = { x + 0.5f, y + 0.5f };
+			float const edge[3] = { edge_equation(p, sv1, sv2), edge_equation(p, sv2, sv0), edge_equation(p, sv0, sv1) };
+			depth_written |= rasterize_quad(tri, edge, false, { x, y }, uni, aa_mode);
+		}
+		if (depth_written)
+			update_max_depth({ start_x, start_y, end_x, end_y });
+	}
+
+	/* bary is anchored at the corner of box, so the result of a pixel does not depend on clip_rect */
+	void rasterize_triangle_and_fragment_shading_and_post_process(
+		VSOut const & vsout0, VSOut const & vsout1, VSOut const & vsout2, bool front_facing,
+		Uniform const & uni, MSAA aa_mode, ScreenRect const & box, ScreenRect const & clip_rect, RenderStats & stats)
+	{
+		auto v0 = vsout0.gl_Position, v1 = vsout1.gl_Position, v2 = vsout2.gl_Position;
+		
+		Vec2f sv0 = { v0.x(), v0.y() }, sv1 = { v1.x(), v1.y() }, sv2 = { v2.x(), v2.y() };
+		Vec3f inv_vertex_w = { 1.0f / v0.w(), 1.0f / v1.w(), 1.0f / v2.w() };
+
+		int const minx = box.minx, miny = box.miny;
+		int const start_x = (std::max)(box.minx, clip_rect.minx), end_x = (std::min)(box.maxx, clip_rect.maxx);
+		int const start_y = (std::max)(box.miny, clip_rect.miny), end_y = (std::min)(box.maxy, clip_rect.maxy);
 
 		Vec2f left_up_corner = { minx + 0.5f, miny + 0.5f };
 		Vec3f left_up_corner_bary = {
@@ -244,126 +1011,220 @@ private:
 				edge_equation(left_up_corner, sv2, sv0),
 				edge_equation(left_up_corner, sv0, sv1) };
 
-		for (int x = minx; x <= maxx - 1; x += 2) for (int y = miny; y <= maxy - 1; y += 2)
-		{
-			QuadOf<Vec3f> quad_bary;
-			QuadOf<float> quad_ratio;
-			QuadOf<bool> quad_need_rast;
+		/* the three edge values always sum up to twice the signed area */
+		TriangleSetup tri = { vsout0, vsout1, vsout2, inv_vertex_w,
+			Vec3f{ v0.z(), v1.z(), v2.z() }, DepthFormat::encode((std::min)(v0.z(), (std::min)(v1.z(), v2.z()))),
+			EdgeSetup(sv0, sv1, sv2, eps), 1.0f / edge_equation(sv0, sv1, sv2), front_facing,
+			&stats, {}, Vec3f::Zero() };
+		EdgeSetup const & edge_setup = tri.edge;
+		if (aa_mode != MSAA::Standard)
+			init_samples(tri, sample_count(aa_mode));
 
-			/* compute barycentric coordinates */
-			for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+		/* block corners are pushed out to the outermost samples, within half a pixel of the center */
+		float const margin = aa_mode != MSAA::Standard ? 0.5f : 0.0f;
+
+		/* blocks sit on the block_size grid of the hierarchical z cells, the first and last ones may be partly outside */
+		int const block_x0 = start_x - start_x % block_size, block_y0 = start_y - start_y % block_size;
+
+		for (int by = block_y0; by <= end_y; by += block_size)
+		{
+			int const y0 = (std::max)(by, start_y), y1 = (std::min)(by + block_size - 1, end_y);
+			for (int bx = block_x0; bx <= end_x; bx += block_size)
 			{
-				auto & bary = quad_bary[i][j];
-				auto & aa_ratio = quad_ratio[i][j]; 
-				bool & need_rast = quad_need_rast[i][j];
-			
-				bary = left_up_corner_bary;
-				aa_ratio = 1.0f;
-				need_rast = true;
+				/* tiles are whole blocks, so x0 and y0 are the same in every tiling; the edge values at them come
+				   straight from the corner of box rather than stepped from the first block of clip_rect */
+				int const x0 = (std::max)(bx, start_x), x1 = (std::min)(bx + block_size - 1, end_x);
+				float row_edge[3];
+				for (int k = 0; k < 3; ++k)
+					row_edge[k] = left_up_corner_bary[k] + ((x0 - minx) * edge_setup.step_x[k] + (y0 - miny) * edge_setup.step_y[k]);
 
-				int const posx = x + i - minx;
-				int const posy = y + j - miny;
+				/* hierarchical z, the triangle is behind every pixel of the block */
+				if (hierarchical_z() && tri.min_depth > m_max_depth_buffer.coeff(bx / block_size, by / block_size)) continue;
 
-				switch (aa_mode) 
+				/* trivial reject or accept, edge functions are linear so the extremes are at the block corners */
+				bool outside = false, inside = true;
+				for (int k = 0; k < 3; ++k)
 				{
-				case MSAA::MSAAx4:
+					float const dx0 = -margin * edge_setup.step_x[k], dx1 = (x1 - x0 + margin) * edge_setup.step_x[k];
+					float const dy0 = -margin * edge_setup.step_y[k], dy1 = (y1 - y0 + margin) * edge_setup.step_y[k];
+					float const lo = row_edge[k] + ((std::min)(dx0, dx1) + (std::min)(dy0, dy1));
+					float const hi = row_edge[k] + ((std::max)(dx0, dx1) + (std::max)(dy0, dy1));
+					if (hi < -eps) outside = true;
+					if (!(lo > eps)) inside = false;
+				}
+				if (outside) continue;
+
+				if (m_lazy_clear)
+					materialize_clear(bx / block_size, by / block_size, ClearColor | ClearDepth);
+
+				bool depth_written = false;
+				for (int y = y0; y <= y1; y += 2)
 				{
-					static std::array<Vec2f, 4> frag_sample_offset =
-					{ Vec2f{ 0.25f, 0.25f },Vec2f{ 0.25f, -0.25f },Vec2f{ -0.25f, 0.25f },Vec2f{ -0.25f, -0.25f } };
+					float edge[3] = { row_edge[0], row_edge[1], row_edge[2] };
+					for (int k = 0; k < 3; ++k)
+						row_edge[k] += 2.0f * edge_setup.step_y[k];
 
-					int sample_inside_cnt = 0;
-					//Vec3f accum_bary = Vec3f::Zero();
-					for (auto const & off : frag_sample_offset)
+					for (int x = x0; x <= x1; x += 2)
 					{
-						Vec2f sample_pos = { posx + off.x(), posy + off.y() };
-						Vec3f sample_bary = bary + Vec3f{
-							sample_pos.x() * line_vec[0].y() - sample_pos.y() * line_vec[0].x(),
-							sample_pos.x() * line_vec[1].y() - sample_pos.y() * line_vec[1].x(),
-							sample_pos.x() * line_vec[2].y() - sample_pos.y() * line_vec[2].x()
-						};
-						if ((sample_bary.x() > eps || (std::abs(sample_bary.x()) < eps && is_top_left[0]))
-							&& (sample_bary.y() > eps || (std::abs(sample_bary.y()) < eps && is_top_left[1]))
-							&& (sample_bary.z() > eps || (std::abs(sample_bary.z()) < eps && is_top_left[2])))
-						{
-							sample_inside_cnt += 1;
-						}
+						depth_written |= rasterize_quad(tri, edge, inside, { x, y }, uni, aa_mode);
+						for (int k = 0; k < 3; ++k)
+							edge[k] += 2.0f * edge_setup.step_x[k];
 					}
-					aa_ratio = float(sample_inside_cnt) * 0.25f;
-
-					if (sample_inside_cnt > 0)
-						need_rast = true;
-					else
-						need_rast = false;
-
-					//accum_bary /= sample_inside_cnt;
-
-					bary = bary + Vec3f{
-						posx * line_vec[0].y() - posy * line_vec[0].x(),
-						posx * line_vec[1].y() - posy * line_vec[1].x(),
-						posx * line_vec[2].y() - posy * line_vec[2].x()
-					};
-					bary /= bary.x() + bary.y() + bary.z();
-				
 				}
-				break;
-				case MSAA::Standard:
+				if (depth_written)
+					update_max_depth({ x0, y0, x1, y1 });
+			}
+		}
+	}
+
+	/* true when a pixel of the quad passed the depth test */
+	bool rasterize_quad(TriangleSetup const & tri, float const (&edge)[3], bool inside, Vec2i const & screen_coord,
+		Uniform const & uni, MSAA aa_mode)
+	{
+		RENDER_STAT_ADD(*tri.stats, quads_visited, 1);
+		float edge_out[3][4];
+		int coverage = 0xf;
+		if (inside)
+			quad_edges(tri.edge, edge, edge_out);
+		else
+			coverage = quad_coverage(tri.edge, edge, edge_out);
+
+		/* multisampling: a pixel is shaded once if any of its samples is covered */
+		int const samples = sample_count(aa_mode);
+		QuadSamples quad_samples;
+		if (samples > 1)
+		{
+			for (int l = 0; l < 4; ++l)
+				quad_samples.mask[l] = inside ? (1 << samples) - 1 : 0;
+			if (!inside)
+			{
+				for (int s = 0; s < samples; ++s)
 				{
-					bary = bary + Vec3f{
-						posx * line_vec[0].y() - posy * line_vec[0].x(),
-						posx * line_vec[1].y() - posy * line_vec[1].x(),
-						posx * line_vec[2].y() - posy * line_vec[2].x()
-					};
-
-					if ((bary.x() > eps || (std::abs(bary.x()) < eps && is_top_left[0]))
-						&& (bary.y() > eps || (std::abs(bary.y()) < eps && is_top_left[1]))
-						&& (bary.z() > eps || (std::abs(bary.z()) < eps && is_top_left[2])))
-						need_rast = true;
-					else
-						need_rast = false;
-
-					bary /= bary.x() + bary.y() + bary.z();
+					auto const & delta = tri.sample_delta[s];
+					float sample_edge_out[3][4];
+					float const sample_edge[3] = {
+						edge_out[0][0] + delta[0], edge_out[1][0] + delta[1], edge_out[2][0] + delta[2] };
+					int const sample_coverage = quad_coverage(tri.edge, sample_edge, sample_edge_out);
+					for (int l = 0; l < 4; ++l)
+						quad_samples.mask[l] |= ((sample_coverage >> l) & 1) << s;
 				}
-				break;
-				default:
-					return;
-				}
-			
+
+				coverage = 0;
+				for (int l = 0; l < 4; ++l)
+					if (quad_samples.mask[l] != 0) coverage |= 1 << l;
 			}
-			if (!(quad_need_rast[0][0] || quad_need_rast[1][0] 
-				|| quad_need_rast[0][1] || quad_need_rast[1][1])) continue;
+		}
+
+		if (coverage == 0) return false;
+		RENDER_STAT_ADD(*tri.stats, quads_covered, 1);
 
-			/* rasterize quad and post process */
-			auto quad_fsout = quad_shading(vsout0, vsout1, vsout2, inv_vertex_w, uni, 
-				quad_need_rast, quad_bary, quad_ratio);
-			quad_post_process(quad_fsout, quad_need_rast, { x, y });
+		/* compute barycentric coordinates */
+		QuadOf<Vec3f> quad_bary;
+		QuadOf<bool> quad_need_rast;
+		for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+		{
+			int const l = i * 2 + j;
+			quad_bary[i][j] = Vec3f{ edge_out[0][l], edge_out[1][l], edge_out[2][l] } * tri.inv_area;
+			quad_need_rast[i][j] = ((coverage >> l) & 1) != 0;
 		}
+
+		/* rasterize quad and post process */
+		QuadOf<FSOut> quad_fsout;
+		if (!quad_shading(tri, uni, quad_need_rast, quad_samples, samples, quad_bary, edge_out, screen_coord, quad_fsout))
+			return false;
+		return quad_post_process(quad_fsout, quad_need_rast, quad_samples, samples, screen_coord, *tri.stats);
 	}
 
-	QuadOf<FSOut> quad_shading(VSOut const & vsout0, VSOut const & vsout1, VSOut const & vsout2,
-		Vec3f const & inv_vertex_w, Uniform const & uni, 
-		QuadOf<bool> const & quad_need_rast, QuadOf<Vec3f> const & bary, QuadOf<float> const & aa_ratio) {
+	/* false when early z rejected the whole quad */
+	bool quad_shading(TriangleSetup const & tri, Uniform const & uni, 
+		QuadOf<bool> & quad_need_rast, QuadSamples & quad_samples, int samples,
+		QuadOf<Vec3f> const & bary, float const (&edge_out)[3][4],
+		Vec2i const & screen_coord, QuadOf<FSOut> & res) {
 		
 		QuadOf<Vec3f> quad_bary_correct;
 		for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
 		{
-			float inv_frag_w = inv_vertex_w.transpose() * bary[i][j];
-			quad_bary_correct[i][j] = proj_correct(bary[i][j], inv_vertex_w, inv_frag_w);
+			float inv_frag_w = tri.inv_vertex_w.transpose() * bary[i][j];
+			quad_bary_correct[i][j] = proj_correct(bary[i][j], tri.inv_vertex_w, inv_frag_w);
+		}
+
+		/* early z test, the varyings of the quad are only interpolated if a pixel survives */
+		bool const early_z = !fragment_writes_depth<FragmentShader>::value;
+		QuadOf<float> quad_depth;
+		if (early_z)
+		{
+			bool visible = false;
+			for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+			{
+				if (quad_need_rast[i][j] == false) continue;
+				int const x = screen_coord.x() + i, y = screen_coord.y() + j;
+				if (samples > 1)
+				{
+					/* per sample, a pixel survives with any of its samples */
+					int const l = i * 2 + j;
+					int & mask = quad_samples.mask[l];
+					depth_type const * stored = m_sample_depth.samples(x, y);
+					for (int s = 0; s < samples; ++s)
+					{
+						if (((mask >> s) & 1) == 0) continue;
+						quad_samples.depth[l][s] = DepthFormat::encode(sample_depth(tri, edge_out, l, s));
+						if (!depth_test(stored[s], quad_samples.depth[l][s]))
+						{
+							mask &= ~(1 << s);
+							RENDER_STAT_ADD(*tri.stats, depth_fails, 1);
+						}
+					}
+					quad_need_rast[i][j] = mask != 0;
+					visible |= mask != 0;
+					continue;
+				}
+
+				auto const & bary_correct = quad_bary_correct[i][j];
+				quad_depth[i][j] = bary_correct.x() * tri.vertex_z.x()
+					+ bary_correct.y() * tri.vertex_z.y()
+					+ bary_correct.z() * tri.vertex_z.z();
+				res[i][j].gl_FragDepth = quad_depth[i][j];
+				if (!depth_test(m_depth_buffer.coeff(x, y), DepthFormat::encode(quad_depth[i][j])))
+				{
+					quad_need_rast[i][j] = false;
+					RENDER_STAT_ADD(*tri.stats, depth_fails, 1);
+				}
+				else
+					visible = true;
+			}
+			if (!visible) return false;
+
+			/* nothing but the depth is needed */
+			if (m_render_mode == RenderMode::DepthOnly) return true;
 		}
-		auto quad_fsin = quad_interp(quad_bary_correct, vsout0, vsout1, vsout2);
+
+		auto quad_fsin = quad_interp(quad_bary_correct, tri.vsout0, tri.vsout1, tri.vsout2);
 		
-		QuadOf<FSOut> res;
 		for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
 		{
-			if (quad_need_rast[i][j] == false) continue;
+			if (quad_need_rast[i][j] == false)
+			{
+				RENDER_STAT_ADD(*tri.stats, helper_lanes, 1);
+				continue;
+			}
+			RENDER_STAT_ADD(*tri.stats, fragments_shaded, 1);
+			quad_fsin[i][j].gl_FrontFacing = tri.front_facing;
 			res[i][j] = FragmentShader()(quad_fsin[i][j], uni);
-			res[i][j].out_color.w() *= aa_ratio[i][j];
+			if (early_z && samples == 1) res[i][j].gl_FragDepth = quad_depth[i][j];
 		}
-		return res;
+		return true;
+	}
+
+	bool depth_test(depth_type stored, depth_type fragment) const
+	{
+		return m_depth_test == DepthTest::Less ? fragment < stored : fragment == stored;
 	}
 
-	void quad_post_process(QuadOf<FSOut> const & quad_fsout, QuadOf<bool> const & quad_need_rast,
-		Vec2i const & screen_coord)
+	bool quad_post_process(QuadOf<FSOut> const & quad_fsout, QuadOf<bool> const & quad_need_rast,
+		QuadSamples const & quad_samples, int samples, Vec2i const & screen_coord, RenderStats & stats)
 	{
+		bool const early_z = !fragment_writes_depth<FragmentShader>::value;
+		bool depth_written = false;
 		for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
 		{
 			if (quad_need_rast[i][j] == false) continue;
@@ -372,16 +1233,56 @@ private:
 			
 			//m_framebuffer.coeff(x, y) = fsout.out_color;
 
+			if (samples > 1)
+			{
+				/* per sample depth test and blend of the one colour shaded for the pixel */
+				int const l = i * 2 + j;
+				color_type * colors = m_sample_color.samples(x, y);
+				depth_type * depths = m_sample_depth.samples(x, y);
+				depth_type const frag_depth = early_z ? depth_type{} : DepthFormat::encode(fsout.gl_FragDepth);
+				for (int s = 0; s < samples; ++s)
+				{
+					if (((quad_samples.mask[l] >> s) & 1) == 0) continue;
+					depth_type const depth = early_z ? quad_samples.depth[l][s] : frag_depth;
+					if (!depth_test(depths[s], depth))
+					{
+						RENDER_STAT_ADD(stats, depth_fails, 1);
+						continue;
+					}
+					RENDER_STAT_ADD(stats, depth_passes, 1);
+					if (m_depth_test == DepthTest::Less)
+					{
+						depths[s] = depth;
+						depth_written = true;
+					}
+					if (m_render_mode == RenderMode::DepthOnly) continue;
+					ColorFormat::blend(colors[s], fsout.out_color);
+					RENDER_STAT_ADD(stats, blends, 1);
+				}
+				continue;
+			}
+
 			/* late z test */
-			if (m_depth_buffer.coeff(x, y) <= fsout.gl_FragDepth) continue;
-			
-			m_depth_buffer.coeff(x, y) = fsout.gl_FragDepth;
+			depth_type const depth = DepthFormat::encode(fsout.gl_FragDepth);
+			if (!depth_test(m_depth_buffer.coeff(x, y), depth))
+			{
+				RENDER_STAT_ADD(stats, depth_fails, 1);
+				continue;
+			}
+			RENDER_STAT_ADD(stats, depth_passes, 1);
+
+			if (m_depth_test == DepthTest::Less)
+			{
+				m_depth_buffer.coeff(x, y) = depth;
+				depth_written = true;
+			}
+			if (m_render_mode == RenderMode::DepthOnly) continue;
 
 			/* alpha blend */
-			auto const & src = m_framebuffer.coeff(x, y);
-			m_framebuffer.coeff(x, y) = lerp(src, fsout.out_color, fsout.out_color.w());
-			m_framebuffer.coeff(x, y).w() = 1.0f;
+			ColorFormat::blend(m_framebuffer.coeff(x, y), fsout.out_color);
+			RENDER_STAT_ADD(stats, blends, 1);
 		}
+		return depth_written;
 	}
 
 };
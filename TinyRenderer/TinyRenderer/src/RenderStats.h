@@ -0,0 +1,145 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/////////////////////////////////
+// pipeline statistics
+/////////////////////////////////
+
+/* counting is compiled out unless RENDER_STATS is 1, RENDER_STAT_ADD then does not even evaluate its value,
+   it only names stats so that a parameter passed for counting alone is not unused */
+#ifndef RENDER_STATS
+#define RENDER_STATS 0
+#endif
+
+#if RENDER_STATS
+#define RENDER_STAT_ADD(stats, counter, value) ((stats).counter += (value))
+#else
+#define RENDER_STAT_ADD(stats, counter, value) ((void)(stats))
+#endif
+
+/* counters and stage timings of one render() call */
+struct RenderStats
+{
+	/* vertex shading, vertices_in are the inputs, shaded counts each shader invocation */
+	uint64_t vertices_in = 0;
+	uint64_t vertices_shaded = 0;
+
+	/* primitive assembly: culled by facing or zero area, rejected outside a frustum plane or clipped away,
+	   clipped when cut by near, far or the guard band, emitted to the rasterizer after clipping */
+	uint64_t triangles_in = 0;
+	uint64_t triangles_culled = 0;
+	uint64_t triangles_rejected = 0;
+	uint64_t triangles_clipped = 0;
+	uint64_t triangles_emitted = 0;
+	/* rejected whole by the hierarchical z, counted once per tile touched */
+	uint64_t triangles_hiz_rejected = 0;
+
+	/* rasterization: quads visited by the rasterizer, and those with a covered pixel */
+	uint64_t quads_visited = 0;
+	uint64_t quads_covered = 0;
+	/* fragment shader invocations, and lanes of the interpolated quads left unshaded */
+	uint64_t fragments_shaded = 0;
+	uint64_t helper_lanes = 0;
+
+	/* per pixel, per sample under MSAA */
+	uint64_t depth_passes = 0;
+	uint64_t depth_fails = 0;
+	uint64_t blends = 0;
+
+	/* nanoseconds: vertex shading, primitive assembly, projection and viewport, binning into tiles,
+	   rasterization with shading and blending, the MSAA resolve at readback (not in total_ns), the whole render() */
+	uint64_t vertex_ns = 0;
+	uint64_t primitive_ns = 0;
+	uint64_t setup_ns = 0;
+	uint64_t binning_ns = 0;
+	uint64_t raster_ns = 0;
+	uint64_t resolve_ns = 0;
+	uint64_t total_ns = 0;
+
+	/* summing the counters of the workers, timings are taken by the calling thread only */
+	RenderStats & operator+=(RenderStats const & rhs)
+	{
+		vertices_in += rhs.vertices_in;
+		vertices_shaded += rhs.vertices_shaded;
+		triangles_in += rhs.triangles_in;
+		triangles_culled += rhs.triangles_culled;
+		triangles_rejected += rhs.triangles_rejected;
+		triangles_clipped += rhs.triangles_clipped;
+		triangles_emitted += rhs.triangles_emitted;
+		triangles_hiz_rejected += rhs.triangles_hiz_rejected;
+		quads_visited += rhs.quads_visited;
+		quads_covered += rhs.quads_covered;
+		fragments_shaded += rhs.fragments_shaded;
+		helper_lanes += rhs.helper_lanes;
+		depth_passes += rhs.depth_passes;
+		depth_fails += rhs.depth_fails;
+		blends += rhs.blends;
+		return *this;
+	}
+
+	/* one flat object, keys as the member names */
+	std::string to_json() const
+	{
+		std::ostringstream os;
+		char const * sep = "{ ";
+		auto const field = [&](char const * name, uint64_t value)
+		{
+			os << sep << '"' << name << "\": " << value;
+			sep = ", ";
+		};
+		field("vertices_in", vertices_in);
+		field("vertices_shaded", vertices_shaded);
+		field("triangles_in", triangles_in);
+		field("triangles_culled", triangles_culled);
+		field("triangles_rejected", triangles_rejected);
+		field("triangles_clipped", triangles_clipped);
+		field("triangles_emitted", triangles_emitted);
+		field("triangles_hiz_rejected", triangles_hiz_rejected);
+		field("quads_visited", quads_visited);
+		field("quads_covered", quads_covered);
+		field("fragments_shaded", fragments_shaded);
+		field("helper_lanes", helper_lanes);
+		field("depth_passes", depth_passes);
+		field("depth_fails", depth_fails);
+		field("blends", blends);
+		field("vertex_ns", vertex_ns);
+		field("primitive_ns", primitive_ns);
+		field("setup_ns", setup_ns);
+		field("binning_ns", binning_ns);
+		field("raster_ns", raster_ns);
+		field("resolve_ns", resolve_ns);
+		field("total_ns", total_ns);
+		os << " }";
+		return os.str();
+	}
+};
+
+/* nanoseconds between laps, a no-op when the stats are compiled out */
+class StatsTimer
+{
+public:
+#if RENDER_STATS
+	StatsTimer() : m_last(std::chrono::steady_clock::now()) {}
+
+	uint64_t lap()
+	{
+		auto const now = std::chrono::steady_clock::now();
+		uint64_t const ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_last).count());
+		m_last = now;
+		return ns;
+	}
+
+private:
+	std::chrono::steady_clock::time_point m_last;
+#else
+	StatsTimer() {}
+	uint64_t lap() { return 0; }
+#endif
+};
+
+#endif
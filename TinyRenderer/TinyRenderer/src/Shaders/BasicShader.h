@@ -1,5 +1,5 @@
-#ifndef BasicShader
-#define BasicShader
+#ifndef BASIC_SHADER_H
+#define BASIC_SHADER_H
 
 #include "../Utils.h"
 #include "../Texture.h"
@@ -69,6 +69,8 @@ struct FSOut : public FSOutPart
 
 struct VertexShader
 {
+	static int const batch_size = 8;
+
 	VSOut operator() (VSIn const & vsin, Uniform const & uni)
 	{
 		VSOut vsout;
@@ -76,6 +78,36 @@ struct VertexShader
 		vsout.tex_coord = vsin.tex_coord;
 		return vsout;
 	}
+
+	/* batch_size vertices as SoA, summed column by column like the Eigen product above */
+	void operator() (VSIn const * vsin, VSOut * vsout, Uniform const & uni)
+	{
+		float px[batch_size], py[batch_size], pz[batch_size];
+		for (int k = 0; k < batch_size; ++k)
+		{
+			px[k] = vsin[k].position.x();
+			py[k] = vsin[k].position.y();
+			pz[k] = vsin[k].position.z();
+		}
+
+		float pos[4][batch_size];
+		for (int r = 0; r < 4; ++r)
+		{
+			float const m0 = uni.wvp(r, 0), m1 = uni.wvp(r, 1), m2 = uni.wvp(r, 2), m3 = uni.wvp(r, 3);
+			for (int k = 0; k < batch_size; ++k)
+#ifdef EIGEN_VECTORIZE_FMA
+				pos[r][k] = std::fma(m2, pz[k], std::fma(m1, py[k], m0 * px[k])) + m3;
+#else
+				pos[r][k] = m0 * px[k] + m1 * py[k] + m2 * pz[k] + m3;
+#endif
+		}
+
+		for (int k = 0; k < batch_size; ++k)
+		{
+			vsout[k].gl_Position = Vec4f{ pos[0][k], pos[1][k], pos[2][k], pos[3][k] };
+			vsout[k].tex_coord = vsin[k].tex_coord;
+		}
+	}
 };
 
 inline VSOut lerp(VSOut const & vsout0, VSOut const & vsout1, float t)
@@ -119,11 +151,13 @@ QuadOf<FSIn> quad_interp(QuadOf<Vec3f> const & quad_bary_correct, VSOut const &
 
 struct FragmentShader
 {
+	/* depth is gl_FragCoord.z, so the pipeline may test it before shading */
+	static bool const writes_depth = false;
+
 	FSOut operator() (FSIn const & fsin, Uniform const & uni)
 	{
 		float tex = uni.texture(fsin.tex_coord.x(), fsin.tex_coord.y());
 		FSOut fsout;
-		fsout.gl_FragDepth = fsin.gl_FragCoord.z();
 		Vec3f color = tex * Vec3f{ 0.4f, 0.0f, 0.0f } +Vec3f{ 0.6f, 0.0f, 0.0f };
 		fsout.out_color = Vec4f{ color.x(), color.y(), color.z(), 1.0f };
 		return fsout;
@@ -0,0 +1,111 @@
+#ifndef PHONG_SHADER_H
+#define PHONG_SHADER_H
+
+#include "../Utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+/* per pixel Phong lighting of a white point light, names prefixed so that it builds next to BasicShader.h */
+struct PhongUniform
+{
+	Mat4f wvp;
+	Vec3f light_pos;
+	Vec3f view_pos;
+	Vec3f light_color;
+	Vec3f albedo;
+	float shininess;
+};
+
+struct PhongVSIn : public VSInPart
+{
+	Vec3f position;
+	Vec3f normal;
+};
+
+struct PhongVSOut : public VSOutPart
+{
+	Vec3f world_pos;
+	Vec3f normal;
+};
+
+struct PhongFSIn : public FSInPart
+{
+	Vec3f world_pos;
+	Vec3f normal;
+};
+
+struct PhongFSOut : public FSOutPart
+{
+};
+
+/* model space is world space */
+struct PhongVertexShader
+{
+	PhongVSOut operator() (PhongVSIn const & vsin, PhongUniform const & uni)
+	{
+		PhongVSOut vsout;
+		vsout.gl_Position = uni.wvp * Vec4f{ vsin.position.x(), vsin.position.y(), vsin.position.z(), 1.0f };
+		vsout.world_pos = vsin.position;
+		vsout.normal = vsin.normal;
+		return vsout;
+	}
+};
+
+inline PhongVSOut lerp(PhongVSOut const & vsout0, PhongVSOut const & vsout1, float t)
+{
+	PhongVSOut vsout;
+	vsout.gl_Position = vsout0.gl_Position * (1.0f - t) + vsout1.gl_Position * t;
+	vsout.world_pos = vsout0.world_pos * (1.0f - t) + vsout1.world_pos * t;
+	vsout.normal = vsout0.normal * (1.0f - t) + vsout1.normal * t;
+	return vsout;
+}
+
+inline QuadOf<PhongFSIn> quad_interp(QuadOf<Vec3f> const & quad_bary_correct,
+	PhongVSOut const & vsout0, PhongVSOut const & vsout1, PhongVSOut const & vsout2)
+{
+	QuadOf<PhongFSIn> quad_fsin;
+	for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+	{
+		auto & fsin = quad_fsin[i][j];
+		auto const & bary_correct = quad_bary_correct[i][j];
+		fsin.gl_FragCoord =
+			bary_correct.x() * vsout0.gl_Position
+			+ bary_correct.y() * vsout1.gl_Position
+			+ bary_correct.z() * vsout2.gl_Position;
+		fsin.world_pos =
+			bary_correct.x() * vsout0.world_pos
+			+ bary_correct.y() * vsout1.world_pos
+			+ bary_correct.z() * vsout2.world_pos;
+		fsin.normal =
+			bary_correct.x() * vsout0.normal
+			+ bary_correct.y() * vsout1.normal
+			+ bary_correct.z() * vsout2.normal;
+	}
+	return quad_fsin;
+}
+
+struct PhongFragmentShader
+{
+	static bool const writes_depth = false;
+
+	PhongFSOut operator() (PhongFSIn const & fsin, PhongUniform const & uni)
+	{
+		/* interpolated normals are renormalized */
+		Vec3f const normal = fsin.normal.normalized();
+		Vec3f const light_dir = (uni.light_pos - fsin.world_pos).normalized();
+		Vec3f const view_dir = (uni.view_pos - fsin.world_pos).normalized();
+		Vec3f const reflect_dir = 2.0f * normal.dot(light_dir) * normal - light_dir;
+
+		float const ambient = 0.1f;
+		float const diffuse = (std::max)(normal.dot(light_dir), 0.0f);
+		float const specular = std::pow((std::max)(view_dir.dot(reflect_dir), 0.0f), uni.shininess);
+		Vec3f const color = ((ambient + diffuse) * uni.albedo + specular * Vec3f::Ones()).cwiseProduct(uni.light_color);
+
+		PhongFSOut fsout;
+		fsout.out_color = Vec4f{ color.x(), color.y(), color.z(), 1.0f };
+		return fsout;
+	}
+};
+
+#endif
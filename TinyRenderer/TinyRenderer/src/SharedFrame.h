@@ -0,0 +1,341 @@
+#ifndef SHARED_FRAME_H
+#define SHARED_FRAME_H
+
+/* POSIX shared memory, for previews on machines without a window */
+#ifndef _WIN32
+
+#include "Utils.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/////////////////////////////////
+// shared memory frame ring
+/////////////////////////////////
+
+/* the mapping holds a SharedFrameHeader, then slot_count slots of a SharedSlotHeader, a byte per tile and
+   the 0x00RRGGBB pixels top row first, every part 64 byte aligned; frames are numbered from 1 and frame f
+   goes to slot (f - 1) % slot_count */
+struct SharedFrameHeader
+{
+	static uint32_t const magic_value = 0x46525452; /* "RTRF" */
+	static uint32_t const version_value = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t slot_count;
+	uint32_t tile_size, tile_cols, tile_rows;
+	uint64_t slot_stride;
+	/* last complete frame, 0 before the first */
+	std::atomic<uint64_t> published;
+};
+
+struct SharedSlotHeader
+{
+	/* 2 * frame - 1 while frame is written into the slot, 2 * frame once it is complete */
+	std::atomic<uint64_t> seq;
+	/* tiles whose pixels differ from the previous frame, flagged by the byte map after this header */
+	uint32_t changed_tile_cnt;
+};
+
+inline size_t shared_frame_align(size_t size)
+{
+	return (size + 63) & ~size_t(63);
+}
+
+/* offsets of the parts of a slot from its start */
+struct SharedSlotLayout
+{
+	size_t changed_offset, pixel_offset, stride;
+
+	SharedSlotLayout(uint32_t width, uint32_t height, uint32_t tile_cnt) :
+		changed_offset(shared_frame_align(sizeof(SharedSlotHeader))),
+		pixel_offset(changed_offset + shared_frame_align(tile_cnt)),
+		stride(pixel_offset + shared_frame_align(size_t(width) * height * sizeof(RGBA32)))
+	{}
+};
+
+/* writer side: owns the shared memory object, removed again by close() */
+class SharedFrameExport
+{
+public:
+	SharedFrameExport() = default;
+	~SharedFrameExport() { close(); }
+
+	SharedFrameExport(SharedFrameExport const &) = delete;
+	SharedFrameExport & operator=(SharedFrameExport const &) = delete;
+
+	/* name as for shm_open, e.g. "/tinyrenderer"; at least 2 slots so a reader can finish the last frame
+	   while the next is written; false if the object cannot be created or mapped */
+	bool create(std::string const & name, int width, int height, int slot_count = 3, int tile_size = 64)
+	{
+		close();
+		slot_count = (std::max)(2, slot_count);
+		tile_size = (std::max)(1, tile_size);
+		uint32_t const tile_cols = (width + tile_size - 1) / tile_size, tile_rows = (height + tile_size - 1) / tile_size;
+		SharedSlotLayout const layout(width, height, tile_cols * tile_rows);
+		size_t const size = shared_frame_align(sizeof(SharedFrameHeader)) + layout.stride * slot_count;
+
+		int const fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+		if (fd < 0) return false;
+		void * mapping = MAP_FAILED;
+		if (ftruncate(fd, off_t(size)) == 0)
+			mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED)
+		{
+			shm_unlink(name.c_str());
+			return false;
+		}
+
+		m_name = name;
+		m_mapping = static_cast<unsigned char *>(mapping);
+		m_size = size;
+		m_width = width;
+		m_height = height;
+		m_slot_count = slot_count;
+		m_tile_size = tile_size;
+		m_tile_cols = tile_cols;
+		m_tile_rows = tile_rows;
+		m_layout = layout;
+		m_frame = 0;
+		m_tile_changed_at.assign(tile_cols * tile_rows, 0);
+		m_rows.resize(height);
+
+		/* the pages come zeroed, published stays 0 until the header is complete */
+		SharedFrameHeader * header = new (m_mapping) SharedFrameHeader;
+		header->width = width;
+		header->height = height;
+		header->slot_count = slot_count;
+		header->tile_size = tile_size;
+		header->tile_cols = tile_cols;
+		header->tile_rows = tile_rows;
+		header->slot_stride = layout.stride;
+		header->version = SharedFrameHeader::version_value;
+		header->published.store(0, std::memory_order_relaxed);
+		for (int s = 0; s < slot_count; ++s)
+			new (slot(s)) SharedSlotHeader;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = SharedFrameHeader::magic_value;
+		return true;
+	}
+
+	void close()
+	{
+		if (!m_mapping) return;
+		munmap(m_mapping, m_size);
+		shm_unlink(m_name.c_str());
+		m_mapping = nullptr;
+	}
+
+	/* rows of the slot of the next frame, top row first, for present_stage to write in place; publish() after */
+	RGBA32 * const * begin_frame()
+	{
+		int const s = int(m_frame % m_slot_count);
+		mark_writing(s);
+		RGBA32 * pixels = slot_pixels(s);
+		for (int y = 0; y < m_height; ++y)
+			m_rows[y] = pixels + size_t(y) * m_width;
+		return m_rows.data();
+	}
+
+	/* completes begin_frame(), every tile flagged changed */
+	void publish()
+	{
+		int const s = int(m_frame % m_slot_count);
+		std::memset(slot_changed(s), 1, m_tile_changed_at.size());
+		slot(s)->changed_tile_cnt = uint32_t(m_tile_changed_at.size());
+		for (auto & frame : m_tile_changed_at)
+			frame = m_frame + 1;
+		finish(s);
+	}
+
+	/* publish the top-down rows of a frame, e.g. device_t::framebuffer, comparing each tile with the previous
+	   frame; a tile is copied only if the slot does not hold it yet, i.e. it changed within the last slot_count frames */
+	void publish_changed(RGBA32 const * const * rows)
+	{
+		int const s = int(m_frame % m_slot_count);
+		int const prev = int((m_frame + m_slot_count - 1) % m_slot_count);
+		uint64_t const frame = m_frame + 1;
+		mark_writing(s);
+
+		RGBA32 * dst = slot_pixels(s);
+		RGBA32 const * last = slot_pixels(prev);
+		unsigned char * changed = slot_changed(s);
+		uint32_t changed_cnt = 0;
+		for (int ty = 0; ty < m_tile_rows; ++ty)
+			for (int tx = 0; tx < m_tile_cols; ++tx)
+			{
+				int const x0 = tx * m_tile_size, x1 = (std::min)(m_width, x0 + m_tile_size);
+				int const y0 = ty * m_tile_size, y1 = (std::min)(m_height, y0 + m_tile_size);
+				size_t const row_bytes = sizeof(RGBA32) * (x1 - x0);
+				int const t = ty * m_tile_cols + tx;
+
+				bool differs = m_frame == 0;
+				for (int y = y0; !differs && y < y1; ++y)
+					differs = std::memcmp(rows[y] + x0, last + size_t(y) * m_width + x0, row_bytes) != 0;
+				if (differs) m_tile_changed_at[t] = frame;
+				changed[t] = differs ? 1 : 0;
+				changed_cnt += differs ? 1 : 0;
+
+				/* the slot holds frame - slot_count, or nothing yet */
+				if (frame > uint64_t(m_slot_count) && m_tile_changed_at[t] + m_slot_count <= frame) continue;
+				for (int y = y0; y < y1; ++y)
+					std::memcpy(dst + size_t(y) * m_width + x0, rows[y] + x0, row_bytes);
+			}
+		slot(s)->changed_tile_cnt = changed_cnt;
+		finish(s);
+	}
+
+	/* frames published so far */
+	uint64_t frame_count() const { return m_frame; }
+
+private:
+	SharedSlotHeader * slot(int s) const
+	{
+		return reinterpret_cast<SharedSlotHeader *>(m_mapping + shared_frame_align(sizeof(SharedFrameHeader)) + m_layout.stride * s);
+	}
+
+	unsigned char * slot_changed(int s) const
+	{
+		return reinterpret_cast<unsigned char *>(slot(s)) + m_layout.changed_offset;
+	}
+
+	RGBA32 * slot_pixels(int s) const
+	{
+		return reinterpret_cast<RGBA32 *>(reinterpret_cast<unsigned char *>(slot(s)) + m_layout.pixel_offset);
+	}
+
+	/* readers still in the slot see the odd seq and drop what they read */
+	void mark_writing(int s)
+	{
+		slot(s)->seq.store(2 * (m_frame + 1) - 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void finish(int s)
+	{
+		++m_frame;
+		slot(s)->seq.store(2 * m_frame, std::memory_order_release);
+		reinterpret_cast<SharedFrameHeader *>(m_mapping)->published.store(m_frame, std::memory_order_release);
+	}
+
+	std::string m_name;
+	unsigned char * m_mapping = nullptr;
+	size_t m_size = 0;
+	int m_width = 0, m_height = 0;
+	int m_slot_count = 0;
+	int m_tile_size = 0, m_tile_cols = 0, m_tile_rows = 0;
+	SharedSlotLayout m_layout = SharedSlotLayout(0, 0, 0);
+	uint64_t m_frame = 0;
+	/* last frame whose tile differed from the one before */
+	std::vector<uint64_t> m_tile_changed_at;
+	std::vector<RGBA32 *> m_rows;
+};
+
+/* a complete frame read in place, valid while SharedFrameReader::validate says so */
+struct SharedFrameView
+{
+	uint64_t frame = 0;
+	int width = 0, height = 0;
+	RGBA32 const * pixels = nullptr;
+	unsigned char const * changed_tiles = nullptr;
+	uint32_t changed_tile_cnt = 0;
+	SharedSlotHeader const * slot = nullptr;
+};
+
+/* reader side, for a viewer or encoder process */
+class SharedFrameReader
+{
+public:
+	SharedFrameReader() = default;
+	~SharedFrameReader() { close(); }
+
+	SharedFrameReader(SharedFrameReader const &) = delete;
+	SharedFrameReader & operator=(SharedFrameReader const &) = delete;
+
+	/* false if no exporter has created name yet */
+	bool open(std::string const & name)
+	{
+		close();
+		int const fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return false;
+		struct stat st;
+		void * mapping = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SharedFrameHeader))
+			mapping = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED) return false;
+
+		m_mapping = static_cast<unsigned char const *>(mapping);
+		m_size = size_t(st.st_size);
+		SharedFrameHeader const * header = this->header();
+		bool const ready = header->magic == SharedFrameHeader::magic_value && header->version == SharedFrameHeader::version_value;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!ready || m_size < shared_frame_align(sizeof(SharedFrameHeader)) + header->slot_stride * header->slot_count)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (!m_mapping) return;
+		munmap(const_cast<unsigned char *>(m_mapping), m_size);
+		m_mapping = nullptr;
+	}
+
+	SharedFrameHeader const * header() const
+	{
+		return reinterpret_cast<SharedFrameHeader const *>(m_mapping);
+	}
+
+	/* the newest complete frame, false if there is none yet or it was being overwritten */
+	bool acquire(SharedFrameView & view) const
+	{
+		SharedFrameHeader const * header = this->header();
+		uint64_t const frame = header->published.load(std::memory_order_acquire);
+		if (frame == 0) return false;
+
+		SharedSlotLayout const layout(header->width, header->height, header->tile_cols * header->tile_rows);
+		unsigned char const * base = m_mapping + shared_frame_align(sizeof(SharedFrameHeader)) +
+			layout.stride * ((frame - 1) % header->slot_count);
+		SharedSlotHeader const * slot = reinterpret_cast<SharedSlotHeader const *>(base);
+		if (slot->seq.load(std::memory_order_acquire) != 2 * frame) return false;
+
+		view.frame = frame;
+		view.width = int(header->width);
+		view.height = int(header->height);
+		view.pixels = reinterpret_cast<RGBA32 const *>(base + layout.pixel_offset);
+		view.changed_tiles = base + layout.changed_offset;
+		view.changed_tile_cnt = slot->changed_tile_cnt;
+		view.slot = slot;
+		return true;
+	}
+
+	/* call after reading the view, false when the writer reused the slot meanwhile and the read is torn */
+	bool validate(SharedFrameView const & view) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return view.slot->seq.load(std::memory_order_relaxed) == 2 * view.frame;
+	}
+
+private:
+	unsigned char const * m_mapping = nullptr;
+	size_t m_size = 0;
+};
+
+#endif
+
+#endif
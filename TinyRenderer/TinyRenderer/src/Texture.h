@@ -1,5 +1,5 @@
-#ifndef Texture
-#define Texture
+#ifndef TEXTURE_H
+#define TEXTURE_H
 
 
 #include "Utils.h"
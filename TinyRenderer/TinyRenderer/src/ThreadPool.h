@@ -0,0 +1,127 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "Trace.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+/////////////////////////////////
+// thread pool
+/////////////////////////////////
+
+/* persistent worker threads, the calling thread joins the work as worker 0 */
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int thread_count = 1)
+	{
+		resize(thread_count);
+	}
+
+	~ThreadPool()
+	{
+		stop();
+	}
+
+	ThreadPool(ThreadPool const &) = delete;
+	ThreadPool & operator=(ThreadPool const &) = delete;
+
+	int size() const
+	{
+		return int(m_workers.size()) + 1;
+	}
+
+	void resize(int thread_count)
+	{
+		stop();
+		m_exit = false;
+		for (int i = 1; i < thread_count; ++i)
+			m_workers.emplace_back(&ThreadPool::worker_loop, this, i, m_generation);
+	}
+
+	/* call task(task_id, worker_id) for every task_id in [0, task_count), return when all are done */
+	void parallel_for(int task_count, std::function<void(int, int)> const & task)
+	{
+		if (m_workers.empty() || task_count <= 1)
+		{
+			for (int i = 0; i < task_count; ++i)
+				task(i, 0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_task = &task;
+			m_task_count = task_count;
+			m_next_task = 0;
+			m_busy_workers = int(m_workers.size());
+			++m_generation;
+		}
+		m_wake.notify_all();
+
+		run_tasks(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_busy_workers == 0; });
+		m_task = nullptr;
+	}
+
+private:
+	/* one span per worker and parallel_for, the gaps between them are waits */
+	void run_tasks(int worker_id)
+	{
+		TRACE_SCOPE_ARG("parallel_for", "worker", worker_id);
+		for (int i = m_next_task++; i < m_task_count; i = m_next_task++)
+			(*m_task)(i, worker_id);
+	}
+
+	void worker_loop(int worker_id, unsigned generation)
+	{
+		Tracer::instance().set_thread_name("worker", worker_id);
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&]() { return m_exit || m_generation != generation; });
+				if (m_exit) return;
+				generation = m_generation;
+			}
+
+			run_tasks(worker_id);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_busy_workers == 0)
+				m_done.notify_one();
+		}
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+		m_wake.notify_all();
+		for (auto & worker : m_workers)
+			worker.join();
+		m_workers.clear();
+	}
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	std::function<void(int, int)> const * m_task = nullptr;
+	int m_task_count = 0;
+	std::atomic<int> m_next_task{ 0 };
+	int m_busy_workers = 0;
+	unsigned m_generation = 0;
+	bool m_exit = false;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/////////////////////////////////
+// timeline tracing
+/////////////////////////////////
+
+/* TRACE_SCOPE spans are compiled in unless RENDER_TRACE is 0, and cost one relaxed load until tracing is enabled */
+#ifndef RENDER_TRACE
+#define RENDER_TRACE 1
+#endif
+
+/* name and arg_name are string literals, only the pointers are kept */
+struct TraceEvent
+{
+	char const * name;
+	char const * arg_name;
+	int64_t arg;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+};
+
+/* the spans of one thread, pushed by that thread only and never locked; the newest capacity spans are kept */
+class TraceRing
+{
+public:
+	TraceRing(int tid, size_t capacity) :
+		m_tid(tid), m_events(capacity)
+	{}
+
+	void push(TraceEvent const & event)
+	{
+		uint64_t const head = m_head.load(std::memory_order_relaxed);
+		m_events[head & (m_events.size() - 1)] = event;
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	int tid() const { return m_tid; }
+
+	/* oldest first */
+	template <typename Fn>
+	void for_each(Fn && fn) const
+	{
+		uint64_t const head = m_head.load(std::memory_order_acquire);
+		uint64_t const cnt = head < m_events.size() ? head : m_events.size();
+		for (uint64_t i = head - cnt; i < head; ++i)
+			fn(m_events[i & (m_events.size() - 1)]);
+	}
+
+	std::string name;
+
+private:
+	int const m_tid;
+	std::vector<TraceEvent> m_events;
+	std::atomic<uint64_t> m_head{ 0 };
+};
+
+/* process wide: a thread gets its ring with its first span, write_chrome_trace() collects them all */
+class Tracer
+{
+public:
+	static Tracer & instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	Tracer(Tracer const &) = delete;
+	Tracer & operator=(Tracer const &) = delete;
+
+	void set_enabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+	bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	/* spans per thread, rounded up to a power of two; applies to threads that have not traced yet */
+	void set_ring_capacity(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_ring_capacity = size;
+	}
+
+	/* label of the calling thread in the timeline, "name index" when index is not negative; cheap before its first span */
+	void set_thread_name(char const * name, int index = -1)
+	{
+		ThreadState & state = thread_state();
+		state.name = name;
+		state.index = index;
+		if (state.ring)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			state.ring->name = thread_label(state);
+		}
+	}
+
+	uint64_t now_ns() const
+	{
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - m_epoch).count());
+	}
+
+	TraceRing & thread_ring()
+	{
+		ThreadState & state = thread_state();
+		if (!state.ring)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_rings.emplace_back(new TraceRing(int(m_rings.size()), m_ring_capacity));
+			state.ring = m_rings.back().get();
+			state.ring->name = thread_label(state);
+		}
+		return *state.ring;
+	}
+
+	/* Chrome trace event JSON, opens in chrome://tracing and Perfetto; call while the traced threads are idle */
+	bool write_chrome_trace(std::string const & path)
+	{
+		FILE * file = std::fopen(path.c_str(), "w");
+		if (!file) return false;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		char const * sep = "\n";
+		std::fprintf(file, "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+		for (auto const & ring : m_rings)
+		{
+			std::fprintf(file, "%s{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": { \"name\": \"%s\" } }",
+				sep, ring->tid(), ring->name.c_str());
+			sep = ",\n";
+			ring->for_each([&](TraceEvent const & event)
+			{
+				std::fprintf(file, ",\n{ \"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+					event.name, ring->tid(), event.begin_ns / 1000.0, (event.end_ns - event.begin_ns) / 1000.0);
+				if (event.arg_name)
+					std::fprintf(file, ", \"args\": { \"%s\": %lld }", event.arg_name, (long long)event.arg);
+				std::fprintf(file, " }");
+			});
+		}
+		std::fprintf(file, "\n] }\n");
+		return std::fclose(file) == 0;
+	}
+
+private:
+	Tracer() :
+		m_epoch(std::chrono::steady_clock::now())
+	{}
+
+	struct ThreadState
+	{
+		TraceRing * ring;
+		char const * name;
+		int index;
+	};
+
+	static ThreadState & thread_state()
+	{
+		thread_local ThreadState state = { nullptr, nullptr, -1 };
+		return state;
+	}
+
+	std::string thread_label(ThreadState const & state) const
+	{
+		if (!state.name)
+			return "thread " + std::to_string(state.ring->tid());
+		std::string label = state.name;
+		if (state.index >= 0)
+			label += " " + std::to_string(state.index);
+		return label;
+	}
+
+	std::chrono::steady_clock::time_point const m_epoch;
+	std::atomic<bool> m_enabled{ false };
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<TraceRing>> m_rings;
+	size_t m_ring_capacity = 1 << 14;
+};
+
+/* one span from construction to the end of the scope, nothing is recorded while tracing is disabled */
+class TraceScope
+{
+public:
+	explicit TraceScope(char const * name, char const * arg_name = nullptr, int64_t arg = 0)
+	{
+		Tracer & tracer = Tracer::instance();
+		if (!tracer.enabled()) return;
+		m_event.name = name;
+		m_event.arg_name = arg_name;
+		m_event.arg = arg;
+		m_event.begin_ns = tracer.now_ns();
+	}
+
+	~TraceScope()
+	{
+		if (!m_event.name) return;
+		Tracer & tracer = Tracer::instance();
+		m_event.end_ns = tracer.now_ns();
+		tracer.thread_ring().push(m_event);
+	}
+
+	TraceScope(TraceScope const &) = delete;
+	TraceScope & operator=(TraceScope const &) = delete;
+
+private:
+	TraceEvent m_event = {};
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#if RENDER_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg_name, arg)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) ((void)0)
+#endif
+
+#endif
@@ -1,10 +1,10 @@
-#ifndef Types
-#define Types
+#ifndef UTILS_H
+#define UTILS_H
 
 #define _USE_MATH_DEFINES // for C++  
 #include <cmath>
 
-#include <Eigen\Core>
+#include <Eigen/Core>
 #include <vector>
 #include <chrono>
 #include <iostream>
@@ -19,24 +19,61 @@ using Vec4f = Eigen::Vector4f;
 using Mat3f = Eigen::Matrix3f;
 using Mat4f = Eigen::Matrix4f;
 
+/* storage orders of Buffer2D, pitch is whatever index needs from the width, computed once */
+struct RowMajor
+{
+	static size_t pitch(size_t width) { return width; }
+	static size_t storage_size(size_t width, size_t height) { return width * height; }
+	static size_t index(int x, int y, size_t pitch) { return y * pitch + x; }
+	/* pixels of a row stored one after another from any x that is a multiple of it */
+	static int row_run(size_t width) { return int(width); }
+};
+
+/* 8x8 tiles one after another along rows of tiles, row-major inside a tile */
+struct Tiled8x8
+{
+	static size_t pitch(size_t width) { return (width + 7) / 8; }
+	static size_t storage_size(size_t width, size_t height) { return pitch(width) * ((height + 7) / 8) * 64; }
+	static size_t index(int x, int y, size_t pitch)
+	{
+		return ((y >> 3) * pitch + (x >> 3)) * 64 + ((y & 7) << 3) + (x & 7);
+	}
+	static int row_run(size_t) { return 8; }
+};
+
+/* 8x8 tiles as Tiled8x8, Morton order inside a tile so that every aligned 2x2 quad is 4 consecutive pixels */
+struct Morton8x8
+{
+	static size_t pitch(size_t width) { return Tiled8x8::pitch(width); }
+	static size_t storage_size(size_t width, size_t height) { return Tiled8x8::storage_size(width, height); }
+	static size_t index(int x, int y, size_t pitch)
+	{
+		/* x bits go to the even positions, y bits to the odd ones */
+		size_t const morton =
+			(x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+		return ((y >> 3) * pitch + (x >> 3)) * 64 + morton;
+	}
+	static int row_run(size_t) { return 2; }
+};
+
 /* bottem left corner is (0, 0) */
-template <typename T>
+template <typename T, typename Layout = RowMajor>
 class Buffer2D
 {
 public:
 	Buffer2D(size_t width, size_t height) :
-		m_width(width), m_height(height),
-		m_storage(height * width, {})
+		m_width(width), m_height(height), m_pitch(Layout::pitch(width)),
+		m_storage(Layout::storage_size(width, height))
 	{}
 
 	T& coeff(int x, int y)
 	{
-		return m_storage[y * m_width + x];
+		return m_storage[Layout::index(x, y, m_pitch)];
 	}
 
 	T const & coeff(int x, int y) const
 	{
-		return m_storage[y * m_width + x];
+		return m_storage[Layout::index(x, y, m_pitch)];
 	}
 
 	void clear(T const & val)
@@ -45,14 +82,119 @@ public:
 			v = val;
 	}
 
+	size_t width() const { return m_width; }
+	size_t height() const { return m_height; }
+
+	/* linearizing copy for readback, rows from y = 0 up */
+	std::vector<T> row_major() const
+	{
+		std::vector<T> res;
+		res.reserve(m_width * m_height);
+		for (int y = 0; y < int(m_height); ++y)
+			for (int x = 0; x < int(m_width); ++x)
+				res.push_back(coeff(x, y));
+		return res;
+	}
+
 private:
-	size_t m_width, m_height;
+	size_t m_width, m_height, m_pitch;
 	std::vector<T> m_storage;
 };
 
+/* the samples of a pixel next to each other, pixels in Layout order, empty until resized */
+template <typename T, typename Layout = RowMajor>
+class SampleBuffer
+{
+public:
+	void resize(size_t width, size_t height, int sample_count, T const & val)
+	{
+		m_pitch = Layout::pitch(width);
+		m_sample_count = sample_count;
+		m_storage.assign(Layout::storage_size(width, height) * sample_count, val);
+	}
+
+	T * samples(int x, int y)
+	{
+		return &m_storage[Layout::index(x, y, m_pitch) * m_sample_count];
+	}
+
+	T const * samples(int x, int y) const
+	{
+		return &m_storage[Layout::index(x, y, m_pitch) * m_sample_count];
+	}
+
+	void clear(T const & val)
+	{
+		for (auto & v : m_storage)
+			v = val;
+	}
+
+	int sample_count() const { return m_sample_count; }
+
+private:
+	size_t m_pitch = 0;
+	int m_sample_count = 0;
+	std::vector<T> m_storage;
+};
+
+/* non-owning pointer and count, the owner keeps the storage alive while the view is used */
+template <typename T>
+class ArrayView
+{
+public:
+	ArrayView() : m_data(nullptr), m_size(0) {}
+	ArrayView(T const * data, size_t size) : m_data(data), m_size(size) {}
+	ArrayView(std::vector<T> const & vec) : m_data(vec.data()), m_size(vec.size()) {}
+
+	T const & operator[](size_t i) const { return m_data[i]; }
+	T const * data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	T const * begin() const { return m_data; }
+	T const * end() const { return m_data + m_size; }
+
+private:
+	T const * m_data;
+	size_t m_size;
+};
+
 enum class MSAA 
 {
-	Standard, MSAAx4
+	Standard, MSAAx4, MSAAx8
+};
+
+inline int sample_count(MSAA msaa)
+{
+	return msaa == MSAA::MSAAx8 ? 8 : (msaa == MSAA::MSAAx4 ? 4 : 1);
+}
+
+/* All shades every input vertex up front, Referenced only vertices the elements use, on first use */
+enum class VertexShading
+{
+	All, Referenced
+};
+
+enum class CullMode
+{
+	None, Front, Back
+};
+
+/* winding of front faces as seen on screen, y axis up */
+enum class FrontFace
+{
+	CCW, CW
+};
+
+/* DepthOnly writes m_depth_buffer alone, without interpolating varyings when the shader keeps depth */
+enum class RenderMode
+{
+	Color, DepthOnly
+};
+
+/* Equal draws what a depth prepass left visible, without writing depth */
+enum class DepthTest
+{
+	Less, Equal
 };
 
 template <typename T>
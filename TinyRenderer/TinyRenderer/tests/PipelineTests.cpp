@@ -0,0 +1,446 @@
+/* regression checks of the pipeline, each compares two ways of drawing the same frames pixel for pixel;
+   exits non zero when one fails */
+
+#include "Utils.h"
+#include "Texture.h"
+#include "RenderStages.h"
+#include "Shaders/BasicShader.h"
+#include <Eigen/Geometry>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+using Pipeline = RenderPipeline<VertexShader, FragmentShader, Uniform, VSIn, VSOut, FSIn, FSOut>;
+using ColorBuffer = Buffer2D<Pipeline::color_type>;
+using Image = std::vector<Vec4f>;
+
+int const width = 256, height = 192;
+
+/* an indexed mesh of overlapping quads sharing their corners, submitted in shuffled order,
+   and a large triangle behind it drawn on its own */
+struct Scene
+{
+	std::vector<VSIn> inputs;
+	std::vector<int> elements;
+	std::vector<int> background;
+
+	Scene()
+	{
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<float> pos(-6.0f, 6.0f), depth(-3.0f, 3.0f);
+		int const grid = 12;
+		for (int y = 0; y < grid; ++y)
+			for (int x = 0; x < grid; ++x)
+			{
+				VSIn vsin;
+				vsin.position = { pos(rng), pos(rng), depth(rng) };
+				vsin.tex_coord = { float(x) / grid, float(y) / grid };
+				inputs.push_back(vsin);
+			}
+
+		std::vector<int> quads;
+		for (int y = 0; y + 1 < grid; ++y)
+			for (int x = 0; x + 1 < grid; ++x)
+				quads.push_back(y * grid + x);
+		std::shuffle(quads.begin(), quads.end(), rng);
+		for (int q : quads)
+		{
+			int const corner[4] = { q, q + 1, q + grid, q + grid + 1 };
+			int const tris[6] = { 0, 1, 2, 2, 1, 3 };
+			for (int k : tris)
+				elements.push_back(corner[k]);
+		}
+
+		Vec3f const far_corners[3] = { { -40.0f, -40.0f, -20.0f }, { 80.0f, -40.0f, -20.0f }, { -40.0f, 80.0f, -20.0f } };
+		for (auto const & position : far_corners)
+		{
+			VSIn vsin;
+			vsin.position = position;
+			vsin.tex_coord = { 0.5f, 0.5f };
+			background.push_back(int(inputs.size()));
+			inputs.push_back(vsin);
+		}
+	}
+};
+
+float const near_plane = 1.0f, far_plane = 100.0f, aspect = 4.0f / 3.0f;
+
+/* 90 degrees wide, a point at view depth d lands on screen from its x / d and aspect * y / d */
+Mat4f test_projection()
+{
+	Mat4f proj = Mat4f::Zero();
+	proj.coeffRef(0, 0) = 1.0f;
+	proj.coeffRef(1, 1) = aspect;
+	proj.coeffRef(2, 2) = -(far_plane + near_plane) / (far_plane - near_plane);
+	proj.coeffRef(2, 3) = -2.0f * far_plane * near_plane / (far_plane - near_plane);
+	proj.coeffRef(3, 2) = -1.0f;
+	return proj;
+}
+
+/* spins around x by frame */
+Uniform frame_uniform(int frame)
+{
+	float const angle = 0.3f * frame;
+	Mat4f const proj = test_projection();
+	Mat4f world;
+	world << 1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, std::cos(angle), -std::sin(angle), 0.0f,
+		0.0f, std::sin(angle), std::cos(angle), -12.0f,
+		0.0f, 0.0f, 0.0f, 1.0f;
+	return Uniform{ Sample2D<FilterBilinear, Texture1, float>{ Texture1{} }, Mat4f(proj * world) };
+}
+
+template <typename Buffer>
+Image read_image(Buffer const & buffer)
+{
+	Image image;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			image.push_back(RGBA32F::decode(buffer.coeff(x, y)));
+	return image;
+}
+
+/* the rows present_stage() writes for buffer */
+std::vector<RGBA32> present_image(Pipeline & renderer, ColorBuffer const & buffer)
+{
+	std::vector<RGBA32> image(width * height);
+	std::vector<RGBA32 *> rows;
+	for (int y = 0; y < height; ++y)
+		rows.push_back(&image[y * width]);
+	renderer.present_stage(buffer, rows.data(), width, height);
+	return image;
+}
+
+template <typename Pixel>
+int count_differences(std::vector<Pixel> const & a, std::vector<Pixel> const & b)
+{
+	int cnt = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (a[i] != b[i]) ++cnt;
+	return cnt;
+}
+
+using DrawFrame = std::function<ColorBuffer const & (Pipeline &, Scene const &, Uniform const &)>;
+
+/* one render() of the whole scene */
+ColorBuffer const & draw_once(Pipeline & renderer, Scene const & scene, Uniform const & uni)
+{
+	return renderer.render(scene.inputs, scene.elements, uni, MSAA::Standard);
+}
+
+/* frame_cnt frames of the scene, set_up configures the pipeline before the first one, draw issues the renders of a frame */
+std::vector<Image> render_frames(int frame_cnt, std::function<void(Pipeline &)> const & set_up,
+	DrawFrame const & draw = draw_once)
+{
+	Scene const scene;
+	Pipeline renderer(width, height);
+	renderer.set_cull_mode(CullMode::None, FrontFace::CW);
+	set_up(renderer);
+
+	std::vector<Image> frames;
+	for (int frame = 0; frame < frame_cnt; ++frame)
+	{
+		renderer.clear_pipeline({ 0.0f, 0.0f, 0.0f, 1.0f });
+		frames.push_back(read_image(draw(renderer, scene, frame_uniform(frame))));
+	}
+	return frames;
+}
+
+bool expect_same_frames(std::vector<Image> const & expected, std::vector<Image> const & actual)
+{
+	bool same = true;
+	for (size_t i = 0; i < expected.size(); ++i)
+	{
+		int const cnt = count_differences(expected[i], actual[i]);
+		if (cnt == 0) continue;
+		std::printf("  frame %d: %d pixels differ\n", int(i), cnt);
+		same = false;
+	}
+	return same;
+}
+
+/////////////////////////////////
+// tests
+/////////////////////////////////
+
+/* a cache of 2 entries makes vertices of one triangle collide, they must not pick up stale stack contents */
+bool test_referenced_vertex_shading()
+{
+	auto const expected = render_frames(6, [](Pipeline & renderer)
+	{
+		renderer.set_vertex_shading(VertexShading::All);
+	});
+	auto const actual = render_frames(6, [](Pipeline & renderer)
+	{
+		renderer.set_vertex_shading(VertexShading::Referenced, 2);
+	});
+	return expect_same_frames(expected, actual);
+}
+
+/* the background and the mesh as two render() calls draw what one render() of both does */
+bool test_two_draws_per_frame()
+{
+	auto const expected = render_frames(4, [](Pipeline &) {},
+		[](Pipeline & renderer, Scene const & scene, Uniform const & uni) -> ColorBuffer const &
+	{
+		std::vector<int> elements = scene.background;
+		elements.insert(elements.end(), scene.elements.begin(), scene.elements.end());
+		return renderer.render(scene.inputs, elements, uni, MSAA::Standard);
+	});
+	auto const actual = render_frames(4, [](Pipeline &) {},
+		[](Pipeline & renderer, Scene const & scene, Uniform const & uni) -> ColorBuffer const &
+	{
+		renderer.render(scene.inputs, scene.background, uni, MSAA::Standard);
+		return draw_once(renderer, scene, uni);
+	});
+	return expect_same_frames(expected, actual);
+}
+
+/* the same with MSAA, the samples of both draws are resolved once when color_buffer() reads the frame back */
+bool test_multisampled_two_draws()
+{
+	auto const expected = render_frames(4, [](Pipeline &) {},
+		[](Pipeline & renderer, Scene const & scene, Uniform const & uni) -> ColorBuffer const &
+	{
+		std::vector<int> elements = scene.background;
+		elements.insert(elements.end(), scene.elements.begin(), scene.elements.end());
+		renderer.render(scene.inputs, elements, uni, MSAA::MSAAx4);
+		return renderer.color_buffer();
+	});
+	auto const actual = render_frames(4, [](Pipeline &) {},
+		[](Pipeline & renderer, Scene const & scene, Uniform const & uni) -> ColorBuffer const &
+	{
+		renderer.render(scene.inputs, scene.background, uni, MSAA::MSAAx4);
+		renderer.render(scene.inputs, scene.elements, uni, MSAA::MSAAx4);
+		return renderer.color_buffer();
+	});
+	/* a frame left unresolved would read back the clear in both */
+	bool drawn = true;
+	for (size_t i = 0; i < actual.size(); ++i)
+	{
+		if (count_differences(actual[i], Image(width * height, Vec4f::Zero())) > 0) continue;
+		std::printf("  frame %d: nothing resolved\n", int(i));
+		drawn = false;
+	}
+	return expect_same_frames(expected, actual) && drawn;
+}
+
+/* tiles rasterized by 4 workers draw what the single threaded loop over the whole screen does */
+bool test_tiled_matches_serial()
+{
+	auto const expected = render_frames(6, [](Pipeline & renderer)
+	{
+		renderer.set_thread_count(1);
+	});
+	auto const actual = render_frames(6, [](Pipeline & renderer)
+	{
+		renderer.set_thread_count(4);
+		renderer.set_tile_size(32);
+	});
+	return expect_same_frames(expected, actual);
+}
+
+/* what present_stage() shows and color_buffer() reads back for each frame */
+struct ShownFrames
+{
+	std::vector<std::vector<RGBA32>> presented;
+	std::vector<Image> read_back;
+};
+
+ShownFrames show_frames(int frame_cnt, bool lazy_clear)
+{
+	Scene const scene;
+	Pipeline renderer(width, height);
+	renderer.set_cull_mode(CullMode::None, FrontFace::CW);
+	renderer.set_lazy_clear(lazy_clear);
+
+	ShownFrames frames;
+	for (int frame = 0; frame < frame_cnt; ++frame)
+	{
+		renderer.clear_pipeline({ 0.0f, 0.0f, 0.0f, 1.0f });
+		frames.presented.push_back(present_image(renderer, draw_once(renderer, scene, frame_uniform(frame))));
+		frames.read_back.push_back(read_image(renderer.color_buffer()));
+	}
+	return frames;
+}
+
+/* lazily cleared cells are shown in the clear colour by present_stage() and filled in by color_buffer(),
+   the spinning mesh leaves cells drawn in one frame untouched in the next */
+bool test_lazy_clear()
+{
+	auto const expected = show_frames(6, false);
+	auto const actual = show_frames(6, true);
+	bool same = true;
+	for (size_t i = 0; i < expected.presented.size(); ++i)
+	{
+		int const present_cnt = count_differences(expected.presented[i], actual.presented[i]);
+		int const read_back_cnt = count_differences(expected.read_back[i], actual.read_back[i]);
+		if (present_cnt == 0 && read_back_cnt == 0) continue;
+		std::printf("  frame %d: %d presented and %d read back pixels differ\n", int(i), present_cnt, read_back_cnt);
+		same = false;
+	}
+	return same;
+}
+
+/* after a multisampled render() every pixel that got colour from a sample reads back a depth nearer than the clear */
+bool test_multisampled_depth()
+{
+	Scene const scene;
+	Pipeline renderer(width, height);
+	renderer.set_cull_mode(CullMode::None, FrontFace::CW);
+	bool ok = true;
+	for (int frame = 0; frame < 4; ++frame)
+	{
+		renderer.clear_pipeline({ 0.0f, 0.0f, 0.0f, 1.0f });
+		renderer.render(scene.inputs, scene.elements, frame_uniform(frame), MSAA::MSAAx4);
+		auto const color = read_image(renderer.color_buffer());
+		auto const & depth = renderer.depth_buffer();
+		int cnt = 0;
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+				if (color[y * width + x] != Vec4f::Zero() && !(D32F::decode(depth.coeff(x, y)) < 1.0f)) ++cnt;
+		if (cnt == 0) continue;
+		std::printf("  frame %d: %d drawn pixels without depth\n", frame, cnt);
+		ok = false;
+	}
+	return ok;
+}
+
+/* what the pixel centres see of a view space triangle between the near and far planes, from a ray per pixel:
+   1 surely covered, 0 surely not, -1 too close to an edge of it to tell */
+std::vector<int> expected_coverage(Vec3f const (&tri)[3])
+{
+	double const bary_margin = 0.01, depth_margin = 0.01;
+	Eigen::Vector3d const v[3] = { tri[0].cast<double>(), tri[1].cast<double>(), tri[2].cast<double>() };
+	Eigen::Vector3d const normal = (v[1] - v[0]).cross(v[2] - v[0]);
+
+	std::vector<int> coverage(width * height, 0);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			/* the point at view depth 1 behind the pixel centre */
+			Eigen::Vector3d const dir = { (x + 0.5) / width * 2.0 - 1.0, ((y + 0.5) / height * 2.0 - 1.0) / aspect, -1.0 };
+			double const facing = normal.dot(dir);
+			if (facing == 0.0) continue;
+			double const depth = normal.dot(v[0]) / facing;
+			Eigen::Vector3d const p = depth * dir;
+
+			double bary_min = 1.0;
+			for (int k = 0; k < 3; ++k)
+			{
+				Eigen::Vector3d const & from = v[(k + 1) % 3], & to = v[(k + 2) % 3];
+				bary_min = (std::min)(bary_min, normal.dot((to - from).cross(p - from)) / normal.squaredNorm());
+			}
+			double const depth_min = (std::min)(depth - near_plane, far_plane - depth);
+			int & c = coverage[y * width + x];
+			if (bary_min > bary_margin && depth_min > depth_margin)
+				c = 1;
+			else if (bary_min > -bary_margin && depth_min > -depth_margin)
+				c = -1;
+		}
+	return coverage;
+}
+
+/* one triangle through the clipper, what it covers judged by the depth it leaves; visible asks for covered pixels */
+bool expect_clip_coverage(char const * name, Vec3f const (&tri)[3], bool visible)
+{
+	std::vector<VSIn> inputs(3);
+	for (int k = 0; k < 3; ++k)
+	{
+		inputs[k].position = tri[k];
+		inputs[k].tex_coord = { float(k == 1), float(k == 2) };
+	}
+	Pipeline renderer(width, height);
+	renderer.set_cull_mode(CullMode::None, FrontFace::CW);
+	renderer.clear_pipeline({ 0.0f, 0.0f, 0.0f, 1.0f });
+	std::vector<int> const elements = { 0, 1, 2 };
+	renderer.render(inputs, elements, Uniform{ Sample2D<FilterBilinear, Texture1, float>{ Texture1{} }, test_projection() },
+		MSAA::Standard);
+	auto const & depth = renderer.depth_buffer();
+
+	auto const expected = expected_coverage(tri);
+	int covered = 0, missed = 0, stray = 0;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			bool const drawn = D32F::decode(depth.coeff(x, y)) < 1.0f;
+			int const c = expected[y * width + x];
+			if (c == 1) ++covered;
+			if (c == 1 && !drawn) ++missed;
+			if (c == 0 && drawn) ++stray;
+		}
+	if (missed == 0 && stray == 0 && (covered > 0) == visible) return true;
+	std::printf("  %s: %d of %d covered pixels missed, %d drawn outside\n", name, missed, covered, stray);
+	return false;
+}
+
+/* triangles cut by the near plane, reaching behind the eye or past the guard band keep what lies in the frustum */
+bool test_clip_coverage()
+{
+	struct Case
+	{
+		char const * name;
+		Vec3f tri[3];
+		bool visible;
+	};
+	Case const cases[] = {
+		{ "near plane", { { 0.0f, -0.2f, -0.5f }, { -3.0f, -2.0f, -5.0f }, { 3.0f, -1.0f, -5.0f } }, true },
+		{ "behind the eye", { { -2.0f, -1.0f, -4.0f }, { 2.0f, -1.0f, -4.0f }, { 0.0f, -1.5f, 3.0f } }, true },
+		{ "guard band", { { -40.0f, -1.0f, -5.0f }, { 3.0f, -1.0f, -5.0f }, { 0.0f, 30.0f, -5.0f } }, true },
+		{ "near plane and guard band sliver", { { -60.0f, -1.0f, -0.3f }, { 3.0f, -1.001f, -6.0f }, { 3.0f, -0.999f, -6.0f } }, true },
+		{ "behind the near plane", { { -1.0f, -1.0f, -0.5f }, { 1.0f, -1.0f, -0.5f }, { 0.0f, 1.0f, -0.5f } }, false },
+		{ "right of the screen", { { 20.0f, -1.0f, -5.0f }, { 30.0f, -1.0f, -5.0f }, { 25.0f, 1.0f, -5.0f } }, false },
+	};
+	bool ok = true;
+	for (auto const & c : cases)
+		ok &= expect_clip_coverage(c.name, c.tri, c.visible);
+	return ok;
+}
+
+/* a DepthOnly prepass followed by a Color pass with DepthTest::Equal draws what a single Color pass does */
+bool test_depth_prepass()
+{
+	auto const expected = render_frames(4, [](Pipeline &) {});
+	auto const actual = render_frames(4, [](Pipeline &) {},
+		[](Pipeline & renderer, Scene const & scene, Uniform const & uni) -> ColorBuffer const &
+	{
+		renderer.set_render_mode(RenderMode::DepthOnly);
+		renderer.set_depth_test(DepthTest::Less);
+		draw_once(renderer, scene, uni);
+		renderer.set_render_mode(RenderMode::Color);
+		renderer.set_depth_test(DepthTest::Equal);
+		return draw_once(renderer, scene, uni);
+	});
+	return expect_same_frames(expected, actual);
+}
+
+int main()
+{
+	struct Test
+	{
+		char const * name;
+		bool (*run)();
+	};
+	Test const tests[] = {
+		{ "referenced_vertex_shading", test_referenced_vertex_shading },
+		{ "two_draws_per_frame", test_two_draws_per_frame },
+		{ "tiled_matches_serial", test_tiled_matches_serial },
+		{ "lazy_clear", test_lazy_clear },
+		{ "multisampled_two_draws", test_multisampled_two_draws },
+		{ "multisampled_depth", test_multisampled_depth },
+		{ "depth_prepass", test_depth_prepass },
+		{ "clip_coverage", test_clip_coverage },
+	};
+
+	int failed = 0;
+	for (auto const & test : tests)
+	{
+		bool const ok = test.run();
+		std::printf("%s %s\n", ok ? "pass" : "FAIL", test.name);
+		if (!ok) ++failed;
+	}
+	return failed == 0 ? 0 : 1;
+}